@@ -23,19 +23,62 @@
 
 #include <openslide-cache.h>
 #include <glib.h>
+#include <string.h>
+
+/*
+ * The cache is sharded by key hash.  Each shard has its own lock,
+ * hashtable, and byte budget, so concurrent readers only contend when
+ * their tiles land in the same shard.  The eviction order across
+ * shards is therefore approximate, which is fine for a tile cache.
+ *
+ * Eviction is segmented LRU rather than plain LRU, so that a
+ * sequential full-slide sweep cannot flush every repeatedly-hit tile.
+ * New tiles enter a probation queue and are promoted to the protected
+ * queue on their second touch; eviction drains probation first, and
+ * the protected queue sheds its tail back into probation when it
+ * outgrows its share of the shard budget.
+ *
+ * If OPENSLIDE_TILE_CACHE_DIR is set, evicted tiles additionally spill
+ * to a per-slide directory under it, and misses consult that store
+ * before falling through to the backend decoder.  The store survives
+ * the process; the operator is responsible for pruning the directory.
+ */
+
+// must be a power of two
+#define CACHE_SHARD_COUNT 16
+
+// a slide only uses a handful of distinct tile sizes
+#define POOL_SIZE_CLASSES 8
 
 // hash table key
 struct _openslide_cache_key {
+  void *owner;  // the openslide_t, so handles can share one cache
   int64_t x;
   int64_t y;
   int32_t level;
 };
 
+struct cache_shard {
+  GMutex *mutex;
+  GQueue *probation;      // tiles touched once
+  GQueue *protected;      // tiles touched more than once
+  GHashTable *hashtable;
+
+  struct _openslide_cache *cache; // for the disk store
+
+  int capacity;
+  int total_size;
+
+  int protected_capacity;
+  int protected_size;
+};
+
 // hash table value
 struct _openslide_cache_value {
-  GList *link;            // direct pointer to the node in the list
+  GList *link;            // direct pointer to the node in its queue
+  GQueue *queue;          // which queue the node is in
   struct _openslide_cache_key *key; // for removing keys when aged out
-  struct _openslide_cache *cache; // sadly, for total_bytes and the list
+  struct cache_shard *shard; // sadly, for total_size and the queues
 
   struct _openslide_cache_entry *entry;  // may outlive the value
 };
@@ -43,32 +86,169 @@ struct _openslide_cache_value {
 // datum
 struct _openslide_cache_entry {
   gint refcount;  // atomic ops only
+  struct _openslide_cache *cache; // for returning the buffer to the pool
   void *data;
   int size;
 };
 
+// free tile buffers of one size, waiting to be reused
+struct buffer_class {
+  int size;       // 0 if the class is unclaimed
+  GSList *buffers;
+};
+
 struct _openslide_cache {
-  GMutex *mutex;
-  GQueue *list;
-  GHashTable *hashtable;
+  gint refcount;  // atomic ops only
+
+  struct cache_shard shards[CACHE_SHARD_COUNT];
 
   int capacity;
-  int total_size;
+
+  // tile buffer pool, so steady-state decoding reuses buffers instead
+  // of hammering the allocator
+  GMutex *pool_mutex;
+  struct buffer_class pool[POOL_SIZE_CLASSES];
+  int pool_size;
+  int pool_capacity;
+
+  // per-slide directory of spilled tiles, or NULL if disabled.
+  // set once before the first read, never changed
+  char *disk_dir;
 };
 
+// draw a tile buffer from the pool, or allocate a fresh one
+void *_openslide_cache_alloc(struct _openslide_cache *cache, int size) {
+  g_mutex_lock(cache->pool_mutex);
+  for (int i = 0; i < POOL_SIZE_CLASSES; i++) {
+    struct buffer_class *class = &cache->pool[i];
+    if (class->size == size && class->buffers != NULL) {
+      void *data = class->buffers->data;
+      class->buffers = g_slist_delete_link(class->buffers, class->buffers);
+      cache->pool_size -= size;
+      g_mutex_unlock(cache->pool_mutex);
+      return data;
+    }
+  }
+  g_mutex_unlock(cache->pool_mutex);
+
+  return g_slice_alloc(size);
+}
+
+// return a buffer obtained from _openslide_cache_alloc
+void _openslide_cache_free(struct _openslide_cache *cache,
+			   void *data, int size) {
+  g_mutex_lock(cache->pool_mutex);
+  if (cache->pool_size + size <= cache->pool_capacity) {
+    for (int i = 0; i < POOL_SIZE_CLASSES; i++) {
+      struct buffer_class *class = &cache->pool[i];
+      if (class->size == 0) {
+	class->size = size;
+      }
+      if (class->size == size) {
+	class->buffers = g_slist_prepend(class->buffers, data);
+	cache->pool_size += size;
+	g_mutex_unlock(cache->pool_mutex);
+	return;
+      }
+    }
+  }
+  g_mutex_unlock(cache->pool_mutex);
+
+  g_slice_free1(size, data);
+}
+
+// pool mutex must be held
+static void drain_buffer_pool(struct _openslide_cache *cache) {
+  for (int i = 0; i < POOL_SIZE_CLASSES; i++) {
+    struct buffer_class *class = &cache->pool[i];
+    while (class->buffers != NULL) {
+      g_slice_free1(class->size, class->buffers->data);
+      class->buffers = g_slist_delete_link(class->buffers, class->buffers);
+    }
+  }
+  cache->pool_size = 0;
+}
+
+// disk store
+static char *tile_path(const char *disk_dir,
+		       int64_t x, int64_t y, int32_t level) {
+  char *name = g_strdup_printf("%d-%" G_GINT64_FORMAT "-%" G_GINT64_FORMAT,
+			       level, x, y);
+  char *path = g_build_filename(disk_dir, name, NULL);
+  g_free(name);
+  return path;
+}
+
+// spill an evicted tile; best-effort, a failure just costs a future
+// decode
+static void disk_store_put(struct _openslide_cache *cache,
+			   const struct _openslide_cache_key *key,
+			   struct _openslide_cache_entry *entry) {
+  char *path = tile_path(cache->disk_dir, key->x, key->y, key->level);
+  if (!g_file_test(path, G_FILE_TEST_EXISTS)) {
+    // g_file_set_contents writes a temporary and renames it, so a
+    // concurrent reader never sees a partial tile
+    g_file_set_contents(path, entry->data, entry->size, NULL);
+  }
+  g_free(path);
+}
+
+static void *disk_store_get(struct _openslide_cache *cache,
+			    int64_t x, int64_t y, int32_t level,
+			    int *size_OUT) {
+  char *path = tile_path(cache->disk_dir, x, y, level);
+  char *contents;
+  gsize length;
+  bool result = g_file_get_contents(path, &contents, &length, NULL);
+  g_free(path);
+  if (!result) {
+    return NULL;
+  }
+
+  // entries are freed through the buffer pool, so copy out of the
+  // g_malloc buffer
+  void *data = _openslide_cache_alloc(cache, length);
+  memcpy(data, contents, length);
+  g_free(contents);
+  *size_OUT = length;
+  return data;
+}
+
+// demote the tail of the protected queue into probation until the
+// protected queue fits its budget
+// shard mutex must be held
+static void possibly_demote(struct cache_shard *shard) {
+  while (shard->protected_size > shard->protected_capacity) {
+    struct _openslide_cache_value *value = g_queue_peek_tail(shard->protected);
+    if (value == NULL) {
+      return;
+    }
+
+    GList *link = value->link;
+    g_queue_unlink(shard->protected, link);
+    g_queue_push_head_link(shard->probation, link);
+    value->queue = shard->probation;
+    shard->protected_size -= value->entry->size;
+  }
+}
+
 // eviction
-// mutex must be held
-static void possibly_evict(struct _openslide_cache *cache, int incoming_size) {
+// shard mutex must be held
+static void possibly_evict(struct cache_shard *shard, int incoming_size) {
   g_assert(incoming_size >= 0);
 
-  int size = cache->total_size + incoming_size;
-  int target = cache->capacity;
+  int size = shard->total_size + incoming_size;
+  int target = shard->capacity;
 
   while(size > target) {
-    // get key of last element
-    struct _openslide_cache_value *value = g_queue_peek_tail(cache->list);
+    // evict once-touched tiles first, so a sweep can't flush the
+    // protected queue
+    struct _openslide_cache_value *value = g_queue_peek_tail(shard->probation);
+    if (value == NULL) {
+      value = g_queue_peek_tail(shard->protected);
+    }
     if (value == NULL) {
-      return; // cache is empty
+      return; // shard is empty
     }
     struct _openslide_cache_key *key = value->key;
 
@@ -76,8 +256,13 @@ static void possibly_evict(struct _openslide_cache *cache, int incoming_size) {
 
     size -= value->entry->size;
 
+    // spill to the disk store before the entry can be freed
+    if (shard->cache->disk_dir != NULL) {
+      disk_store_put(shard->cache, key, value->entry);
+    }
+
     // remove from hashtable, this will trigger removal from everything
-    bool result = g_hash_table_remove(cache->hashtable, key);
+    bool result = g_hash_table_remove(shard->hashtable, key);
     g_assert(result);
   }
 }
@@ -90,8 +275,17 @@ static guint hash_func(gconstpointer key) {
   // assume 32-bit hash
 
   // take the top 4 bits for level, then 14 bits per x and y,
-  // xor it all together
-  return (guint) ((c_key->level << 28) ^ (c_key->y << 14) ^ (c_key->x));
+  // xor it all together, then mix in the owning slide so handles
+  // sharing a cache spread across the table
+  return (guint) ((c_key->level << 28) ^ (c_key->y << 14) ^ (c_key->x)) ^
+    (guint) (GPOINTER_TO_SIZE(c_key->owner) >> 4);
+}
+
+static struct cache_shard *get_shard(struct _openslide_cache *cache,
+                                     const struct _openslide_cache_key *key) {
+  // remix, since the hashtables also consume hash_func directly
+  guint hash = hash_func(key) * 2654435761u;
+  return &cache->shards[hash >> (32 - 4)]; // log2(CACHE_SHARD_COUNT)
 }
 
 static gboolean key_equal_func(gconstpointer a,
@@ -99,7 +293,8 @@ static gboolean key_equal_func(gconstpointer a,
   const struct _openslide_cache_key *c_a = a;
   const struct _openslide_cache_key *c_b = b;
 
-  return (c_a->x == c_b->x) && (c_a->y == c_b->y) &&
+  return (c_a->owner == c_b->owner) &&
+    (c_a->x == c_b->x) && (c_a->y == c_b->y) &&
     (c_a->level == c_b->level);
 }
 
@@ -110,12 +305,16 @@ static void hash_destroy_key(gpointer data) {
 static void hash_destroy_value(gpointer data) {
   struct _openslide_cache_value *value = data;
 
-  // remove the item from the list
-  g_queue_delete_link(value->cache->list, value->link);
+  // remove the item from its queue
+  g_queue_delete_link(value->queue, value->link);
 
-  // decrement the total size
-  value->cache->total_size -= value->entry->size;
-  g_assert(value->cache->total_size >= 0);
+  // decrement the sizes
+  if (value->queue == value->shard->protected) {
+    value->shard->protected_size -= value->entry->size;
+    g_assert(value->shard->protected_size >= 0);
+  }
+  value->shard->total_size -= value->entry->size;
+  g_assert(value->shard->total_size >= 0);
 
   // unref the entry
   _openslide_cache_entry_unref(value->entry);
@@ -124,59 +323,152 @@ static void hash_destroy_value(gpointer data) {
   g_slice_free(struct _openslide_cache_value, value);
 }
 
+// distribute the total budget across shards
+static void set_shard_capacities(struct _openslide_cache *cache,
+                                 bool evict) {
+  int per_shard = cache->capacity / CACHE_SHARD_COUNT;
+
+  for (int i = 0; i < CACHE_SHARD_COUNT; i++) {
+    struct cache_shard *shard = &cache->shards[i];
+    g_mutex_lock(shard->mutex);
+    shard->capacity = per_shard;
+    // the protected queue gets most of the budget; the rest is room
+    // for tiles to prove themselves
+    shard->protected_capacity = per_shard - per_shard / 4;
+    if (evict) {
+      possibly_demote(shard);
+      possibly_evict(shard, 0);
+    }
+    g_mutex_unlock(shard->mutex);
+  }
+
+  // the pool rides on top of the cache budget
+  g_mutex_lock(cache->pool_mutex);
+  cache->pool_capacity = cache->capacity / 4;
+  g_mutex_unlock(cache->pool_mutex);
+}
+
 struct _openslide_cache *_openslide_cache_create(int capacity_in_bytes) {
   struct _openslide_cache *cache = g_slice_new0(struct _openslide_cache);
 
-  // init mutex
-  cache->mutex = g_mutex_new();
+  g_atomic_int_set(&cache->refcount, 1);
+
+  for (int i = 0; i < CACHE_SHARD_COUNT; i++) {
+    struct cache_shard *shard = &cache->shards[i];
 
-  // init queue
-  cache->list = g_queue_new();
+    shard->cache = cache;
 
-  // init hashtable
-  cache->hashtable = g_hash_table_new_full(hash_func,
-					   key_equal_func,
-					   hash_destroy_key,
-					   hash_destroy_value);
+    // init mutex
+    shard->mutex = g_mutex_new();
+
+    // init queues
+    shard->probation = g_queue_new();
+    shard->protected = g_queue_new();
+
+    // init hashtable
+    shard->hashtable = g_hash_table_new_full(hash_func,
+					     key_equal_func,
+					     hash_destroy_key,
+					     hash_destroy_value);
+  }
+
+  // init buffer pool
+  cache->pool_mutex = g_mutex_new();
 
   // init byte_capacity
   cache->capacity = capacity_in_bytes;
+  set_shard_capacities(cache, false);
+
+  return cache;
+}
+
+// enable the disk store for this cache.  must be called before the
+// first read; a failure to create the directory leaves it disabled
+void _openslide_cache_set_disk_store(struct _openslide_cache *cache,
+				     const char *slide_id) {
+  const char *root = g_getenv("OPENSLIDE_TILE_CACHE_DIR");
+  if (root == NULL) {
+    return;
+  }
+
+  char *dir = g_build_filename(root, slide_id, NULL);
+  if (g_mkdir_with_parents(dir, 0700)) {
+    g_free(dir);
+    return;
+  }
+  cache->disk_dir = dir;
+}
 
+struct _openslide_cache *_openslide_cache_ref(struct _openslide_cache *cache) {
+  g_atomic_int_inc(&cache->refcount);
   return cache;
 }
 
-void _openslide_cache_destroy(struct _openslide_cache *cache) {
-  // clear hashtable (auto-deletes all data)
-  g_mutex_lock(cache->mutex);
-  g_hash_table_unref(cache->hashtable);
-  g_mutex_unlock(cache->mutex);
+void _openslide_cache_unref(struct _openslide_cache *cache) {
+  if (!g_atomic_int_dec_and_test(&cache->refcount)) {
+    return;
+  }
+
+  for (int i = 0; i < CACHE_SHARD_COUNT; i++) {
+    struct cache_shard *shard = &cache->shards[i];
 
-  // clear list
-  g_queue_free(cache->list);
+    // clear hashtable (auto-deletes all data)
+    g_mutex_lock(shard->mutex);
+    g_hash_table_unref(shard->hashtable);
+    g_mutex_unlock(shard->mutex);
 
-  // free mutex
-  g_mutex_free(cache->mutex);
+    // clear queues
+    g_queue_free(shard->probation);
+    g_queue_free(shard->protected);
+
+    // free mutex
+    g_mutex_free(shard->mutex);
+  }
+
+  // free pooled buffers
+  g_mutex_lock(cache->pool_mutex);
+  drain_buffer_pool(cache);
+  g_mutex_unlock(cache->pool_mutex);
+  g_mutex_free(cache->pool_mutex);
+
+  // the disk store intentionally outlives us
+  g_free(cache->disk_dir);
 
   // destroy struct
   g_slice_free(struct _openslide_cache, cache);
 }
 
 
+static gboolean key_has_owner(gpointer key,
+			      gpointer value G_GNUC_UNUSED,
+			      gpointer user_data) {
+  const struct _openslide_cache_key *c_key = key;
+  return c_key->owner == user_data;
+}
+
+// drop every tile belonging to one owner, for when a slide detaches
+// from a shared cache; its pointer may be recycled by a later open
+void _openslide_cache_purge_owner(struct _openslide_cache *cache,
+				  void *owner) {
+  for (int i = 0; i < CACHE_SHARD_COUNT; i++) {
+    struct cache_shard *shard = &cache->shards[i];
+
+    g_mutex_lock(shard->mutex);
+    g_hash_table_foreach_remove(shard->hashtable, key_has_owner, owner);
+    g_mutex_unlock(shard->mutex);
+  }
+}
+
 int _openslide_cache_get_capacity(struct _openslide_cache *cache) {
-  g_mutex_lock(cache->mutex);
-  int capacity = cache->capacity;
-  g_mutex_unlock(cache->mutex);
-  return capacity;
+  return g_atomic_int_get(&cache->capacity);
 }
 
 void _openslide_cache_set_capacity(struct _openslide_cache *cache,
 				   int capacity_in_bytes) {
   g_assert(capacity_in_bytes >= 0);
 
-  g_mutex_lock(cache->mutex);
-  cache->capacity = capacity_in_bytes;
-  possibly_evict(cache, 0);
-  g_mutex_unlock(cache->mutex);
+  g_atomic_int_set(&cache->capacity, capacity_in_bytes);
+  set_shard_capacities(cache, true);
 }
 
 // put and get
@@ -184,6 +476,7 @@ void _openslide_cache_set_capacity(struct _openslide_cache *cache,
 // the cache retains one reference, and the caller gets another one.  the
 // entry must be unreffed when the caller is done with it.
 void _openslide_cache_put(struct _openslide_cache *cache,
+			  void *owner,
 			  int64_t x,
 			  int64_t y,
 			  int32_t level,
@@ -195,24 +488,30 @@ void _openslide_cache_put(struct _openslide_cache *cache,
       g_slice_new(struct _openslide_cache_entry);
   // one ref for the caller
   g_atomic_int_set(&entry->refcount, 1);
+  entry->cache = cache;
   entry->data = data;
   entry->size = size_in_bytes;
   *_entry = entry;
 
+  struct _openslide_cache_key shard_key = { .owner = owner,
+					    .x = x, .y = y, .level = level };
+  struct cache_shard *shard = get_shard(cache, &shard_key);
+
   // lock
-  g_mutex_lock(cache->mutex);
+  g_mutex_lock(shard->mutex);
 
   // don't try to put anything in the cache that cannot possibly fit
-  if (size_in_bytes > cache->capacity) {
+  if (size_in_bytes > shard->capacity) {
     //g_debug("refused %p", entry);
-    g_mutex_unlock(cache->mutex);
+    g_mutex_unlock(shard->mutex);
     return;
   }
 
-  possibly_evict(cache, size_in_bytes); // already checks for size >= 0
+  possibly_evict(shard, size_in_bytes); // already checks for size >= 0
 
   // create key
   struct _openslide_cache_key *key = g_slice_new(struct _openslide_cache_key);
+  key->owner = owner;
   key->x = x;
   key->y = y;
   key->level = level;
@@ -221,53 +520,76 @@ void _openslide_cache_put(struct _openslide_cache *cache,
   struct _openslide_cache_value *value =
     g_slice_new(struct _openslide_cache_value);
   value->key = key;
-  value->cache = cache;
+  value->shard = shard;
   value->entry = entry;
 
-  // insert at head of queue
-  g_queue_push_head(cache->list, value);
-  value->link = g_queue_peek_head_link(cache->list);
+  // new tiles start on probation
+  g_queue_push_head(shard->probation, value);
+  value->link = g_queue_peek_head_link(shard->probation);
+  value->queue = shard->probation;
 
   // insert into hash table
-  g_hash_table_replace(cache->hashtable, key, value);
+  g_hash_table_replace(shard->hashtable, key, value);
 
   // increase size
-  cache->total_size += size_in_bytes;
+  shard->total_size += size_in_bytes;
 
   // another ref for the cache
   g_atomic_int_inc(&entry->refcount);
 
   // unlock
-  g_mutex_unlock(cache->mutex);
+  g_mutex_unlock(shard->mutex);
 
   //g_debug("insert %p", entry);
 }
 
 // entry must be unreffed when the caller is done with the data
 void *_openslide_cache_get(struct _openslide_cache *cache,
+			   void *owner,
 			   int64_t x,
 			   int64_t y,
 			   int32_t level,
 			   struct _openslide_cache_entry **_entry) {
-  // lock
-  g_mutex_lock(cache->mutex);
-
   // create key
-  struct _openslide_cache_key key = { .x = x, .y = y, .level = level };
+  struct _openslide_cache_key key = { .owner = owner,
+				      .x = x, .y = y, .level = level };
+  struct cache_shard *shard = get_shard(cache, &key);
+
+  // lock
+  g_mutex_lock(shard->mutex);
 
   // lookup key, maybe return NULL
-  struct _openslide_cache_value *value = g_hash_table_lookup(cache->hashtable,
+  struct _openslide_cache_value *value = g_hash_table_lookup(shard->hashtable,
 							     &key);
   if (value == NULL) {
-    g_mutex_unlock(cache->mutex);
+    g_mutex_unlock(shard->mutex);
+
+    // try the disk store; a hit is reinserted into the memory tier.
+    // racing threads may both load the same tile, but the duplicate
+    // insert is harmless and both copies are freed normally
+    if (cache->disk_dir != NULL) {
+      int size;
+      void *data = disk_store_get(cache, x, y, level, &size);
+      if (data != NULL) {
+	_openslide_cache_put(cache, owner, x, y, level, data, size, _entry);
+	return data;
+      }
+    }
+
     *_entry = NULL;
     return NULL;
   }
 
-  // if found, move to front of list
+  // if found, promote to (or refresh within) the protected queue
   GList *link = value->link;
-  g_queue_unlink(cache->list, link);
-  g_queue_push_head_link(cache->list, link);
+  g_queue_unlink(value->queue, link);
+  if (value->queue == shard->probation) {
+    // second touch
+    value->queue = shard->protected;
+    shard->protected_size += value->entry->size;
+  }
+  g_queue_push_head_link(shard->protected, link);
+  possibly_demote(shard);
 
   // acquire entry reference for the caller
   struct _openslide_cache_entry *entry = value->entry;
@@ -276,7 +598,7 @@ void *_openslide_cache_get(struct _openslide_cache *cache,
   //g_debug("cache hit! %p %"G_GINT64_FORMAT" %"G_GINT64_FORMAT" %d", entry, x, y, level);
 
   // unlock
-  g_mutex_unlock(cache->mutex);
+  g_mutex_unlock(shard->mutex);
 
   // return data
   *_entry = entry;
@@ -288,8 +610,8 @@ void _openslide_cache_entry_unref(struct _openslide_cache_entry *entry) {
   //g_debug("unref %p, refs %d", entry, g_atomic_int_get(&entry->refcount));
 
   if (g_atomic_int_dec_and_test(&entry->refcount)) {
-    // free the data
-    g_slice_free1(entry->size, entry->data);
+    // return the data to the buffer pool
+    _openslide_cache_free(entry->cache, entry->data, entry->size);
 
     // free the entry
     g_slice_free(struct _openslide_cache_entry, entry);
@@ -31,10 +31,33 @@
 struct _openslide_cache;
 struct _openslide_cache_entry;
 
-// constructor/destructor
+// constructor/refcounting.  a cache may be shared by several slide
+// handles; tiles are keyed by owner, and _openslide_cache_purge_owner
+// must be called before an owner pointer goes away
 struct _openslide_cache *_openslide_cache_create(int capacity_in_bytes);
 
-void _openslide_cache_destroy(struct _openslide_cache *cache);
+struct _openslide_cache *_openslide_cache_ref(struct _openslide_cache *cache);
+
+void _openslide_cache_unref(struct _openslide_cache *cache);
+
+void _openslide_cache_purge_owner(struct _openslide_cache *cache,
+				  void *owner);
+
+// optional disk store for evicted tiles, rooted at
+// $OPENSLIDE_TILE_CACHE_DIR/<slide_id>; no-op if the variable is unset.
+// only usable on caches with a single owner
+void _openslide_cache_set_disk_store(struct _openslide_cache *cache,
+				     const char *slide_id);
+
+
+// tile buffer pool.  tile data destined for the cache should be
+// allocated here so that evicted buffers can be reused; buffers put
+// into the cache are returned to the pool automatically when the last
+// entry reference is dropped
+void *_openslide_cache_alloc(struct _openslide_cache *cache, int size);
+
+void _openslide_cache_free(struct _openslide_cache *cache,
+			   void *data, int size);
 
 
 // cache size
@@ -43,8 +66,9 @@ int _openslide_cache_get_capacity(struct _openslide_cache *cache);
 void _openslide_cache_set_capacity(struct _openslide_cache *cache,
 				   int capacity_in_bytes);
 
-// put and get
+// put and get.  owner is the openslide_t the tile belongs to
 void _openslide_cache_put(struct _openslide_cache *cache,
+			  void *owner,
 			  int64_t x,
 			  int64_t y,
 			  int32_t level,
@@ -53,6 +77,7 @@ void _openslide_cache_put(struct _openslide_cache *cache,
 			  struct _openslide_cache_entry **entry);
 
 void *_openslide_cache_get(struct _openslide_cache *cache,
+			   void *owner,
 			   int64_t x,
 			   int64_t y,
 			   int32_t level,
@@ -28,15 +28,50 @@
 #include <string.h>
 #include <glib.h>
 
+/*
+ * Hashing is recorded, not performed, while a slide is being opened:
+ * each call appends an operation describing the bytes to hash, and the
+ * SHA-256 runs only when the digest is first requested.  This keeps
+ * openslide_open() from reading back the entire lowest-resolution level
+ * for callers that never look at the quickhash-1 property.
+ */
+
+struct hash_op {
+  // exactly one of str and filename is non-NULL
+  char *str;
+  char *filename;
+  int64_t offset;
+  int64_t size;
+};
+
 struct _openslide_hash {
-  GChecksum *checksum;
+  GSList *ops;  // newest first
   bool enabled;
+  // serializes digest computation; per-hash, so concurrent handles
+  // don't contend
+  GMutex *mutex;
+  char *digest;
 };
 
+static void hash_op_destroy(gpointer data,
+			    gpointer user_data G_GNUC_UNUSED) {
+  struct hash_op *op = data;
+
+  g_free(op->str);
+  g_free(op->filename);
+  g_slice_free(struct hash_op, op);
+}
+
+static void free_ops(struct _openslide_hash *hash) {
+  g_slist_foreach(hash->ops, hash_op_destroy, NULL);
+  g_slist_free(hash->ops);
+  hash->ops = NULL;
+}
+
 struct _openslide_hash *_openslide_hash_quickhash1_create(void) {
-  struct _openslide_hash *hash = g_slice_new(struct _openslide_hash);
-  hash->checksum = g_checksum_new(G_CHECKSUM_SHA256);
+  struct _openslide_hash *hash = g_slice_new0(struct _openslide_hash);
   hash->enabled = true;
+  hash->mutex = g_mutex_new();
 
   return hash;
 }
@@ -46,12 +81,9 @@ void _openslide_hash_string(struct _openslide_hash *hash, const char *str) {
     return;
   }
 
-  GChecksum *checksum = hash->checksum;
-
-  const char *str_to_hash = str ? str : "";
-  g_checksum_update(checksum,
-		    (const guchar *) str_to_hash,
-		    strlen(str_to_hash) + 1);
+  struct hash_op *op = g_slice_new0(struct hash_op);
+  op->str = g_strdup(str ? str : "");
+  hash->ops = g_slist_prepend(hash->ops, op);
 }
 
 bool _openslide_hash_tiff_tiles(struct _openslide_hash *hash, TIFF *tiff,
@@ -113,7 +145,35 @@ bool _openslide_hash_file_part(struct _openslide_hash *hash,
 			       const char *filename,
 			       int64_t offset, int64_t size,
 			       GError **err) {
-  FILE *f = _openslide_fopen(filename, "rb", err);
+  // verify the range now, so bad data still fails openslide_open(),
+  // but defer the reads and the SHA-256 until the digest is requested
+  int64_t file_size = _openslide_fsize(filename, err);
+  if (file_size == -1) {
+    return false;
+  }
+  if (offset < 0 || size < 0 || offset + size > file_size) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_BAD_DATA,
+                "Hash range outside of %s", filename);
+    return false;
+  }
+
+  if (hash == NULL || !hash->enabled) {
+    return true;
+  }
+
+  struct hash_op *op = g_slice_new0(struct hash_op);
+  op->filename = g_strdup(filename);
+  op->offset = offset;
+  op->size = size;
+  hash->ops = g_slist_prepend(hash->ops, op);
+
+  return true;
+}
+
+static bool hash_file_part_now(GChecksum *checksum,
+                               const char *filename,
+                               int64_t offset, int64_t size) {
+  FILE *f = _openslide_fopen(filename, "rb", NULL);
   if (f == NULL) {
     return false;
   }
@@ -121,7 +181,6 @@ bool _openslide_hash_file_part(struct _openslide_hash *hash,
   uint8_t buf[4096];
 
   if (fseeko(f, offset, SEEK_SET) == -1) {
-    _openslide_io_error(err, "Can't seek in %s", filename);
     fclose(f);
     return false;
   }
@@ -132,35 +191,88 @@ bool _openslide_hash_file_part(struct _openslide_hash *hash,
     int64_t bytes_read = fread(buf, 1, bytes_to_read, f);
 
     if (bytes_read != bytes_to_read) {
-      g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_BAD_DATA,
-                  "Can't read from %s", filename);
       fclose(f);
       return false;
     }
 
-    //    g_debug("hash '%s' %" G_GINT64_FORMAT " %d", filename, offset + (size - bytes_left), bytes_to_read);
-
     bytes_left -= bytes_read;
-
-    if (hash != NULL) {
-      GChecksum *checksum = hash->checksum;
-      g_checksum_update(checksum, buf, bytes_read);
-    }
+    g_checksum_update(checksum, buf, bytes_read);
   }
 
   fclose(f);
   return true;
 }
 
+bool _openslide_hash_is_enabled(struct _openslide_hash *hash) {
+  return hash->enabled;
+}
+
+void _openslide_hash_set_digest(struct _openslide_hash *hash,
+                                const char *digest) {
+  if (!hash->enabled) {
+    return;
+  }
+
+  g_mutex_lock(hash->mutex);
+  if (hash->digest == NULL) {
+    hash->digest = g_strdup(digest);
+    // the recorded operations will never be replayed
+    free_ops(hash);
+  }
+  g_mutex_unlock(hash->mutex);
+}
+
+bool _openslide_hash_has_digest(struct _openslide_hash *hash) {
+  g_mutex_lock(hash->mutex);
+  bool result = (hash->digest != NULL);
+  g_mutex_unlock(hash->mutex);
+  return result;
+}
+
 const char *_openslide_hash_get_string(struct _openslide_hash *hash) {
-  if (hash->enabled) {
-    return g_checksum_get_string(hash->checksum);
-  } else {
+  if (!hash->enabled) {
     return NULL;
   }
+
+  g_mutex_lock(hash->mutex);
+  if (hash->digest == NULL) {
+    GChecksum *checksum = g_checksum_new(G_CHECKSUM_SHA256);
+
+    hash->ops = g_slist_reverse(hash->ops);
+    bool success = true;
+    for (GSList *iter = hash->ops; success && iter != NULL;
+         iter = iter->next) {
+      struct hash_op *op = iter->data;
+      if (op->str != NULL) {
+        g_checksum_update(checksum,
+                          (const guchar *) op->str,
+                          strlen(op->str) + 1);
+      } else {
+        success = hash_file_part_now(checksum, op->filename,
+                                     op->offset, op->size);
+      }
+    }
+
+    if (success) {
+      hash->digest = g_strdup(g_checksum_get_string(checksum));
+    } else {
+      // the ranges were validated at open, so the file has changed or
+      // become unreadable underneath us
+      g_warning("Cannot read data back while computing quickhash-1");
+      hash->enabled = false;
+    }
+
+    g_checksum_free(checksum);
+    free_ops(hash);
+  }
+  g_mutex_unlock(hash->mutex);
+
+  return hash->digest;
 }
 
 void _openslide_hash_destroy(struct _openslide_hash *hash) {
-  g_checksum_free(hash->checksum);
+  free_ops(hash);
+  g_mutex_free(hash->mutex);
+  g_free(hash->digest);
   g_slice_free(struct _openslide_hash, hash);
 }
@@ -47,8 +47,18 @@ bool _openslide_hash_file_part(struct _openslide_hash *hash,
 			       int64_t offset, int64_t size,
 			       GError **err);
 
-// accessor
+// accessors
+// true if a digest will be available; cheap
+bool _openslide_hash_is_enabled(struct _openslide_hash *hash);
+// computes the digest on first call; NULL if disabled or unreadable
 const char *_openslide_hash_get_string(struct _openslide_hash *hash);
+// true if the digest is already known; never triggers computation
+bool _openslide_hash_has_digest(struct _openslide_hash *hash);
+
+// seed the digest from a trusted source, skipping computation;
+// ignored if the digest has already been computed
+void _openslide_hash_set_digest(struct _openslide_hash *hash,
+                                const char *digest);
 
 // destructor
 void _openslide_hash_destroy(struct _openslide_hash *hash);
@@ -0,0 +1,310 @@
+/*
+ *  OpenSlide, a library for reading whole slide image files
+ *
+ *  Copyright (c) 2007-2013 Carnegie Mellon University
+ *  All rights reserved.
+ *
+ *  OpenSlide is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, version 2.1.
+ *
+ *  OpenSlide is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with OpenSlide. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * I/O provider support.
+ *
+ * When a provider is registered, _openslide_fopen() hands back a
+ * fopencookie() stream that forwards to the provider, so the backends
+ * keep their stdio code unchanged.  Between the stream and the
+ * provider sits a process-wide block cache: reads are turned into
+ * aligned 1MB block fetches, sequential access widens a fetch up to
+ * 4MB of readahead, and blocks survive the open/close churn of the
+ * TIFF and JPEG read paths.  This keeps a high-latency provider (an
+ * object store, say) down to a few large requests per tile.
+ */
+
+#include <config.h>
+
+#ifdef HAVE_FOPENCOOKIE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+
+#include "openslide-private.h"
+
+// the registered provider; set before any slides are open, so reads
+// of these don't need the lock
+static const struct openslide_io_provider *io_provider;
+static void *io_provider_data;
+
+bool _openslide_io_provider_active(void) {
+  return io_provider != NULL;
+}
+
+#ifdef HAVE_FOPENCOOKIE
+
+#define IO_BLOCK_SIZE (1 << 20)
+#define IO_MAX_READAHEAD_BLOCKS 4
+#define IO_CACHE_CAPACITY (32 << 20)
+
+struct io_block {
+  char *key;        // "<filename>/<block number>"
+  char *data;
+  int64_t len;
+  GList *link;      // node in io_block_lru
+};
+
+// block cache, shared by every stream so reopening a file hits it
+static GStaticMutex io_block_mutex = G_STATIC_MUTEX_INIT;
+static GHashTable *io_blocks;
+static GQueue *io_block_lru;
+static int64_t io_block_bytes;
+
+struct io_stream {
+  char *filename;
+  void *handle;     // provider file handle
+  int64_t size;
+  int64_t offset;
+
+  // the block just past the previous fetch, for readahead detection
+  int64_t next_sequential_block;
+};
+
+static char *block_key(const char *filename, int64_t block) {
+  return g_strdup_printf("%s/%" G_GINT64_FORMAT, filename, block);
+}
+
+// block mutex must be held
+static void evict_blocks(void) {
+  while (io_block_bytes > IO_CACHE_CAPACITY) {
+    struct io_block *victim = g_queue_peek_tail(io_block_lru);
+    g_queue_delete_link(io_block_lru, victim->link);
+    g_hash_table_remove(io_blocks, victim->key);
+    io_block_bytes -= victim->len;
+    g_free(victim->key);
+    g_free(victim->data);
+    g_slice_free(struct io_block, victim);
+  }
+}
+
+// fetch [first, first + count) blocks in one provider read and insert
+// them into the block cache.  returns false on provider failure
+static bool fetch_blocks(struct io_stream *stream,
+			 int64_t first, int64_t count) {
+  int64_t start = first * IO_BLOCK_SIZE;
+  int64_t len = MIN(count * IO_BLOCK_SIZE, stream->size - start);
+  if (len <= 0) {
+    return true;
+  }
+
+  char *buf = g_malloc(len);
+  int64_t total = 0;
+  while (total < len) {
+    int64_t result = io_provider->pread(stream->handle, buf + total,
+					len - total, start + total);
+    if (result <= 0) {
+      g_free(buf);
+      return false;
+    }
+    total += result;
+  }
+
+  g_static_mutex_lock(&io_block_mutex);
+  for (int64_t i = 0; i * IO_BLOCK_SIZE < len; i++) {
+    char *key = block_key(stream->filename, first + i);
+    if (g_hash_table_lookup(io_blocks, key)) {
+      // someone else fetched it meanwhile
+      g_free(key);
+      continue;
+    }
+
+    struct io_block *block = g_slice_new(struct io_block);
+    block->key = key;
+    block->len = MIN(IO_BLOCK_SIZE, len - i * IO_BLOCK_SIZE);
+    block->data = g_memdup(buf + i * IO_BLOCK_SIZE, block->len);
+    g_queue_push_head(io_block_lru, block);
+    block->link = g_queue_peek_head_link(io_block_lru);
+    g_hash_table_insert(io_blocks, block->key, block);
+    io_block_bytes += block->len;
+  }
+  evict_blocks();
+  g_static_mutex_unlock(&io_block_mutex);
+
+  g_free(buf);
+  stream->next_sequential_block = first + (len + IO_BLOCK_SIZE - 1) /
+    IO_BLOCK_SIZE;
+  return true;
+}
+
+// block mutex must be held.  copies what the named block holds of the
+// request; returns -1 if the block isn't cached
+static int64_t copy_from_block(const char *key, char *buf,
+			       int64_t count, int64_t in_block) {
+  struct io_block *block = g_hash_table_lookup(io_blocks, key);
+  if (block == NULL) {
+    return -1;
+  }
+
+  // freshen
+  g_queue_unlink(io_block_lru, block->link);
+  g_queue_push_head_link(io_block_lru, block->link);
+
+  int64_t n = MIN(count, block->len - in_block);
+  if (n <= 0) {
+    return 0;
+  }
+  memcpy(buf, block->data + in_block, n);
+  return n;
+}
+
+// copy one block's worth of the request out of the cache, fetching on
+// a miss.  returns the number of bytes copied, or -1 on failure
+static int64_t read_from_block(struct io_stream *stream, char *buf,
+			       int64_t count, int64_t offset) {
+  int64_t blockno = offset / IO_BLOCK_SIZE;
+  int64_t in_block = offset - blockno * IO_BLOCK_SIZE;
+
+  char *key = block_key(stream->filename, blockno);
+  g_static_mutex_lock(&io_block_mutex);
+  int64_t n = copy_from_block(key, buf, count, in_block);
+  g_static_mutex_unlock(&io_block_mutex);
+
+  if (n == -1) {
+    // sequential access gets readahead, random access a single block
+    int64_t fetch = (blockno == stream->next_sequential_block) ?
+      IO_MAX_READAHEAD_BLOCKS : 1;
+    if (fetch_blocks(stream, blockno, fetch)) {
+      g_static_mutex_lock(&io_block_mutex);
+      n = copy_from_block(key, buf, count, in_block);
+      g_static_mutex_unlock(&io_block_mutex);
+    }
+  }
+
+  g_free(key);
+  return n;
+}
+
+static ssize_t io_cookie_read(void *cookie, char *buf, size_t count) {
+  struct io_stream *stream = cookie;
+
+  int64_t total = 0;
+  while (total < (int64_t) count && stream->offset < stream->size) {
+    int64_t n = read_from_block(stream, buf + total, count - total,
+				stream->offset);
+    if (n < 0) {
+      return total ? total : -1;
+    }
+    if (n == 0) {
+      break;
+    }
+    total += n;
+    stream->offset += n;
+  }
+  return total;
+}
+
+static int io_cookie_seek(void *cookie, off64_t *offset, int whence) {
+  struct io_stream *stream = cookie;
+
+  switch (whence) {
+  case SEEK_SET:
+    stream->offset = *offset;
+    break;
+  case SEEK_CUR:
+    stream->offset += *offset;
+    break;
+  case SEEK_END:
+    stream->offset = stream->size + *offset;
+    break;
+  default:
+    return -1;
+  }
+  if (stream->offset < 0) {
+    return -1;
+  }
+  *offset = stream->offset;
+  return 0;
+}
+
+static int io_cookie_close(void *cookie) {
+  struct io_stream *stream = cookie;
+
+  io_provider->close(stream->handle);
+  g_free(stream->filename);
+  g_slice_free(struct io_stream, stream);
+  return 0;
+}
+
+FILE *_openslide_io_fopen(const char *path, GError **err) {
+  void *handle = io_provider->open(path, io_provider_data);
+  if (handle == NULL) {
+    _openslide_io_error(err, "I/O provider couldn't open %s", path);
+    return NULL;
+  }
+
+  int64_t size = io_provider->size(handle);
+  if (size < 0) {
+    io_provider->close(handle);
+    _openslide_io_error(err, "I/O provider couldn't size %s", path);
+    return NULL;
+  }
+
+  struct io_stream *stream = g_slice_new0(struct io_stream);
+  stream->filename = g_strdup(path);
+  stream->handle = handle;
+  stream->size = size;
+
+  cookie_io_functions_t funcs = {
+    .read = io_cookie_read,
+    .write = NULL,
+    .seek = io_cookie_seek,
+    .close = io_cookie_close,
+  };
+  FILE *f = fopencookie(stream, "rb", funcs);
+  if (f == NULL) {
+    io_cookie_close(stream);
+    _openslide_io_error(err, "Couldn't create stream for %s", path);
+    return NULL;
+  }
+  return f;
+}
+
+void openslide_set_io_provider(const struct openslide_io_provider *provider,
+			       void *provider_data) {
+  g_static_mutex_lock(&io_block_mutex);
+  if (io_blocks == NULL) {
+    io_blocks = g_hash_table_new(g_str_hash, g_str_equal);
+    io_block_lru = g_queue_new();
+  }
+  io_provider = provider;
+  io_provider_data = provider_data;
+  g_static_mutex_unlock(&io_block_mutex);
+}
+
+#else
+
+FILE *_openslide_io_fopen(const char *path, GError **err) {
+  _openslide_io_error(err, "No I/O provider support; couldn't open %s", path);
+  return NULL;
+}
+
+void openslide_set_io_provider(const struct openslide_io_provider *provider,
+			       void *provider_data G_GNUC_UNUSED) {
+  if (provider != NULL) {
+    g_warning("I/O providers are not supported on this platform");
+  }
+}
+
+#endif
@@ -46,6 +46,9 @@
 #include "openslide-cache.h"
 #include "openslide-tilehelper.h"
 
+// enough to keep a few spindles busy without swamping the machine
+#define RESTART_MARKER_THREAD_COUNT 4
+
 struct one_jpeg {
   char *filename;
   int64_t start_in_file;
@@ -57,9 +60,17 @@ struct one_jpeg {
   int32_t width;
   int32_t height;
 
+  // guards the lazy fields below; per-file, so background scanners of
+  // different files don't serialize against each other
+  GMutex *mutex;
+
   int32_t mcu_starts_count;
-  int64_t *mcu_starts;
+  int64_t *mcu_starts;    // lazily allocated under mutex
   int64_t *unreliable_mcu_starts;
+
+  // lazily-created read-only mapping of the file, for zero-copy decode
+  GMappedFile *mapped_file;
+  bool mapped_file_failed;
 };
 
 struct tile {
@@ -78,8 +89,23 @@ struct tile {
   double dest_offset_y;
 };
 
+// the tiles of one level, shared with its scale_denom derivatives.
+// all tile records live in one contiguous block; well-populated grids
+// index them with a flat per-cell pointer array, mostly-empty ones
+// with a hashtable
+struct tile_grid {
+  gint refcount;  // atomic ops only
+
+  struct tile *records;
+  int64_t record_count;
+
+  // exactly one of these is non-NULL
+  struct tile **dense;    // indexed by tileno within the grid
+  GHashTable *sparse;     // int64_t tileno -> struct tile *
+};
+
 struct level {
-  GHashTable *tiles;
+  struct tile_grid *grid;
 
   int32_t tiles_across;
   int32_t tiles_down;
@@ -114,15 +140,24 @@ struct jpegops_data {
   // level_count is in the osr struct
   struct level *levels;
 
+  // set when new restart markers are discovered, so we know the
+  // on-disk MCU-start index is out of date.  writers only ever store
+  // true, so the unlocked stores are harmless
+  bool mcu_starts_dirty;
+
   // thread stuff, for background search of restart markers
   GTimer *restart_marker_timer;
-  GMutex *restart_marker_mutex;
-  GThread *restart_marker_thread;
+  GThread *restart_marker_threads[RESTART_MARKER_THREAD_COUNT];
+  int32_t restart_marker_thread_count;
 
   GCond *restart_marker_cond;
   GMutex *restart_marker_cond_mutex;
   uint32_t restart_marker_users;
   bool restart_marker_thread_stop;
+  bool *marker_scanned;      // per-jpeg claim flags; guarded by cond mutex
+
+  // jpegno behind the most recent tile decode; atomic ops only
+  gint restart_marker_hint;
 };
 
 struct jpeg_associated_image_ctx {
@@ -141,21 +176,65 @@ struct read_region_args {
 /*
  * Source manager for doing fancy things with libjpeg and restart markers,
  * initially copied from jdatasrc.c from IJG libjpeg.
+ *
+ * The input is presented as a short list of segments: when the file is
+ * memory-mapped, the header and tile data are pointed at directly in the
+ * mapping with a static EOI marker appended, so nothing is copied; when
+ * mapping is unavailable, a single segment covers the traditional
+ * freshly-read buffer.
  */
+#define SRC_SEGMENT_COUNT 3
+
 struct my_src_mgr {
   struct jpeg_source_mgr pub;   /* public fields */
 
-  JOCTET *buffer;               /* start of buffer */
+  JOCTET *buffer;               /* start of buffer, NULL when mapped */
   int buffer_size;
+
+  const JOCTET *segments[SRC_SEGMENT_COUNT];
+  size_t segment_lengths[SRC_SEGMENT_COUNT];
+  int next_segment;
 };
 
+// the trailing byte of the tile data is replaced by this on the
+// zero-copy path, since we cannot rewrite the mapping
+static const JOCTET eoi_marker[1] = { JPEG_EOI };
+
 static void init_source (j_decompress_ptr cinfo G_GNUC_UNUSED) {
   /* nothing to be done */
 }
 
+static boolean fill_input_buffer (j_decompress_ptr cinfo) {
+  struct my_src_mgr *src = (struct my_src_mgr *) cinfo->src;
+
+  while (src->next_segment < SRC_SEGMENT_COUNT) {
+    int i = src->next_segment++;
+    if (src->segment_lengths[i]) {
+      src->pub.next_input_byte = src->segments[i];
+      src->pub.bytes_in_buffer = src->segment_lengths[i];
+      return TRUE;
+    }
+  }
+
+  // out of data; insert a fake EOI like the standard stdio source does
+  WARNMS(cinfo, JWRN_JPEG_EOF);
+  src->pub.next_input_byte = eoi_marker;
+  src->pub.bytes_in_buffer = sizeof eoi_marker;
+  return TRUE;
+}
+
 static void skip_input_data (j_decompress_ptr cinfo, long num_bytes) {
   struct my_src_mgr *src = (struct my_src_mgr *) cinfo->src;
 
+  if (num_bytes <= 0) {
+    return;
+  }
+
+  // may cross a segment boundary
+  while ((size_t) num_bytes > src->pub.bytes_in_buffer) {
+    num_bytes -= src->pub.bytes_in_buffer;
+    fill_input_buffer(cinfo);
+  }
   src->pub.next_input_byte += (size_t) num_bytes;
   src->pub.bytes_in_buffer -= (size_t) num_bytes;
 }
@@ -167,6 +246,7 @@ static void term_source (j_decompress_ptr cinfo G_GNUC_UNUSED) {
 
 static void jpeg_random_access_src (openslide_t *osr,
 				    j_decompress_ptr cinfo, FILE *infile,
+				    GMappedFile *map,
 				    int64_t header_start_position,
 				    int64_t header_stop_position,
 				    int64_t start_position, int64_t stop_position) {
@@ -180,11 +260,20 @@ static void jpeg_random_access_src (openslide_t *osr,
 
   src = (struct my_src_mgr *) cinfo->src;
   src->pub.init_source = init_source;
-  src->pub.fill_input_buffer = NULL;  /* this should never be called */
+  src->pub.fill_input_buffer = fill_input_buffer;
   src->pub.skip_input_data = skip_input_data;
   src->pub.resync_to_restart = jpeg_resync_to_restart; /* use default method */
   src->pub.term_source = term_source;
 
+  // start empty; the first fill_input_buffer loads the first segment
+  src->buffer = NULL;
+  src->buffer_size = 0;
+  memset(src->segments, 0, sizeof src->segments);
+  memset(src->segment_lengths, 0, sizeof src->segment_lengths);
+  src->next_segment = 0;
+  src->pub.next_input_byte = NULL;
+  src->pub.bytes_in_buffer = 0;
+
   // check for problems
   if ((header_start_position == -1) || (header_stop_position == -1) ||
       (start_position == -1) || (stop_position == -1) ||
@@ -198,24 +287,36 @@ static void jpeg_random_access_src (openslide_t *osr,
 	       "stop_position: %" G_GINT64_FORMAT,
 	       header_start_position, header_stop_position,
 	       start_position, stop_position);
-
-    src->buffer_size = 0;
-    src->pub.bytes_in_buffer = 0;
-    src->buffer = NULL;
     return;
   }
 
-  // compute size of buffer and allocate
   int header_length = header_stop_position - header_start_position;
   int data_length = stop_position - start_position;
 
+  if (map != NULL &&
+      stop_position <= (int64_t) g_mapped_file_get_length(map)) {
+    // zero-copy: point straight into the mapping
+    const JOCTET *contents = (const JOCTET *) g_mapped_file_get_contents(map);
+
+    if (contents[stop_position - 2] != 0xFF) {
+      _openslide_set_error(osr, "Expected 0xFF byte at end of JPEG data");
+      return;
+    }
+
+    src->segments[0] = contents + header_start_position;
+    src->segment_lengths[0] = header_length;
+    // all but the last byte, which must become EOI
+    src->segments[1] = contents + start_position;
+    src->segment_lengths[1] = data_length - 1;
+    src->segments[2] = eoi_marker;
+    src->segment_lengths[2] = sizeof eoi_marker;
+    return;
+  }
+
+  // fallback: read both parts into a buffer
   src->buffer_size = header_length + data_length;
-  src->pub.bytes_in_buffer = src->buffer_size;
   src->buffer = g_slice_alloc(src->buffer_size);
 
-  src->pub.next_input_byte = src->buffer;
-
-  // read in the 2 parts
   //  g_debug("reading header from %" G_GINT64_FORMAT, header_start_position);
   fseeko(infile, header_start_position, SEEK_SET);
   if (!fread(src->buffer, header_length, 1, infile)) {
@@ -235,6 +336,51 @@ static void jpeg_random_access_src (openslide_t *osr,
     return;
   }
   src->buffer[src->buffer_size - 1] = JPEG_EOI;
+
+  src->segments[0] = src->buffer;
+  src->segment_lengths[0] = src->buffer_size;
+}
+
+// the grid is dense unless the pointer array would dwarf the tiles it
+// points to
+static struct tile_grid *tile_grid_create(int64_t cells,
+					  int64_t tile_count) {
+  struct tile_grid *grid = g_slice_new0(struct tile_grid);
+  grid->refcount = 1;
+  grid->records = g_new0(struct tile, tile_count);
+
+  if (cells <= tile_count * 8) {
+    grid->dense = g_new0(struct tile *, cells);
+  } else {
+    grid->sparse = g_hash_table_new_full(_openslide_int64_hash,
+					 _openslide_int64_equal,
+					 _openslide_int64_free, NULL);
+  }
+  return grid;
+}
+
+static struct tile_grid *tile_grid_ref(struct tile_grid *grid) {
+  g_atomic_int_inc(&grid->refcount);
+  return grid;
+}
+
+static void tile_grid_unref(struct tile_grid *grid) {
+  if (g_atomic_int_dec_and_test(&grid->refcount)) {
+    g_free(grid->records);
+    g_free(grid->dense);
+    if (grid->sparse) {
+      g_hash_table_unref(grid->sparse);
+    }
+    g_slice_free(struct tile_grid, grid);
+  }
+}
+
+static struct tile *tile_grid_lookup(struct tile_grid *grid,
+				     int64_t tileindex) {
+  if (grid->dense) {
+    return grid->dense[tileindex];
+  }
+  return g_hash_table_lookup(grid->sparse, &tileindex);
 }
 
 static void level_free(gpointer data) {
@@ -242,15 +388,10 @@ static void level_free(gpointer data) {
 
   struct level *l = data;
 
-  //  g_debug("g_free(%p)", l->level_jpegs);
-  g_hash_table_unref(l->tiles);
+  tile_grid_unref(l->grid);
   g_slice_free(struct level, l);
 }
 
-static void tile_free(gpointer data) {
-  g_slice_free(struct tile, data);
-}
-
 static void struct_openslide_jpeg_tile_free(gpointer data) {
   g_slice_free(struct _openslide_jpeg_tile, data);
 }
@@ -258,6 +399,7 @@ static void struct_openslide_jpeg_tile_free(gpointer data) {
 struct convert_tiles_args {
   struct level *new_l;
   struct one_jpeg **all_jpegs;
+  int64_t next_record;
 };
 
 static void convert_tiles(gpointer key,
@@ -267,8 +409,8 @@ static void convert_tiles(gpointer key,
   struct _openslide_jpeg_tile *old_tile = value;
   struct level *new_l = args->new_l;
 
-  // create new tile
-  struct tile *new_tile = g_slice_new(struct tile);
+  // claim the next contiguous tile record
+  struct tile *new_tile = &new_l->grid->records[args->next_record++];
   new_tile->jpeg = args->all_jpegs[old_tile->fileno];
   new_tile->jpegno = old_tile->fileno;
   new_tile->tileno = old_tile->tileno;
@@ -319,10 +461,15 @@ static void convert_tiles(gpointer key,
   //  g_debug("%p: extra_left: %d, extra_right: %d, extra_top: %d, extra_bottom: %d", new_l, new_l->extra_tiles_left, new_l->extra_tiles_right, new_l->extra_tiles_top, new_l->extra_tiles_bottom);
 
 
-  // insert tile into new table
-  int64_t *newkey = g_slice_new(int64_t);
-  *newkey = *((int64_t *) key);
-  g_hash_table_insert(new_l->tiles, newkey, new_tile);
+  // index the tile
+  int64_t tileindex = *((int64_t *) key);
+  if (new_l->grid->dense) {
+    new_l->grid->dense[tileindex] = new_tile;
+  } else {
+    int64_t *newkey = g_slice_new(int64_t);
+    *newkey = tileindex;
+    g_hash_table_insert(new_l->grid->sparse, newkey, new_tile);
+  }
 }
 
 static uint8_t find_next_ff_marker(FILE *f,
@@ -386,10 +533,176 @@ static uint8_t find_next_ff_marker(FILE *f,
   }
 }
 
+/*
+ * Sidecar index of restart marker offsets.
+ *
+ * Scanning for restart markers with find_next_ff_marker() is the slow
+ * part of seeking in VMS and MIRAX slides, and the results never change
+ * for a given file.  We persist the merged mcu_starts arrays next to the
+ * first JPEG data file so that a later open can skip the scan.  Loaded
+ * offsets are fed in as unreliable_mcu_starts, so each one is verified
+ * against the file before use, just like vendor-provided hints; a stale
+ * or corrupt index therefore degrades to a rescan rather than an error.
+ */
+
+#define MCU_START_INDEX_SUFFIX ".openslide-index"
+#define MCU_START_INDEX_MAGIC "OpenSlideJPEGindex"
+#define MCU_START_INDEX_VERSION 1
+
+static char *get_mcu_start_index_path(struct jpegops_data *data) {
+  return g_strconcat(data->all_jpegs[0]->filename, MCU_START_INDEX_SUFFIX,
+                     NULL);
+}
+
+static bool read_le_int64(FILE *f, int64_t *result) {
+  int64_t tmp;
+  if (fread(&tmp, sizeof tmp, 1, f) != 1) {
+    return false;
+  }
+  *result = GINT64_FROM_LE(tmp);
+  return true;
+}
+
+static bool write_le_int64(FILE *f, int64_t value) {
+  int64_t tmp = GINT64_TO_LE(value);
+  return fwrite(&tmp, sizeof tmp, 1, f) == 1;
+}
+
+static void load_mcu_start_index(struct jpegops_data *data) {
+  char *path = get_mcu_start_index_path(data);
+  FILE *f = _openslide_fopen(path, "rb", NULL);
+  g_free(path);
+  if (f == NULL) {
+    // no index; not an error
+    return;
+  }
+
+  // header
+  char magic[sizeof(MCU_START_INDEX_MAGIC)];
+  int64_t version;
+  int64_t jpeg_count;
+  if (fread(magic, sizeof magic, 1, f) != 1 ||
+      memcmp(magic, MCU_START_INDEX_MAGIC, sizeof magic) != 0 ||
+      !read_le_int64(f, &version) ||
+      version != MCU_START_INDEX_VERSION ||
+      !read_le_int64(f, &jpeg_count) ||
+      jpeg_count != data->jpeg_count) {
+    //g_debug("rejecting MCU-start index header");
+    fclose(f);
+    return;
+  }
+
+  for (int32_t i = 0; i < data->jpeg_count; i++) {
+    struct one_jpeg *oj = data->all_jpegs[i];
+
+    // per-file header; the layout must match what we see on disk now
+    int64_t start_in_file;
+    int64_t end_in_file;
+    int64_t mcu_starts_count;
+    if (!read_le_int64(f, &start_in_file) ||
+        start_in_file != oj->start_in_file ||
+        !read_le_int64(f, &end_in_file) ||
+        end_in_file != oj->end_in_file ||
+        !read_le_int64(f, &mcu_starts_count) ||
+        mcu_starts_count != oj->mcu_starts_count) {
+      //g_debug("rejecting MCU-start index entry %d", i);
+      fclose(f);
+      return;
+    }
+
+    // read offsets into a temporary so a short read can't leave a
+    // half-populated array
+    int64_t *offsets = g_new(int64_t, oj->mcu_starts_count);
+    for (int32_t j = 0; j < oj->mcu_starts_count; j++) {
+      if (!read_le_int64(f, &offsets[j])) {
+        g_free(offsets);
+        fclose(f);
+        return;
+      }
+    }
+
+    // merge as unreliable starts, to be verified on first use
+    if (oj->unreliable_mcu_starts == NULL) {
+      oj->unreliable_mcu_starts = offsets;
+    } else {
+      for (int32_t j = 0; j < oj->mcu_starts_count; j++) {
+        if (oj->unreliable_mcu_starts[j] == -1) {
+          oj->unreliable_mcu_starts[j] = offsets[j];
+        }
+      }
+      g_free(offsets);
+    }
+  }
+
+  fclose(f);
+}
+
+static void save_mcu_start_index(struct jpegops_data *data) {
+  if (!data->mcu_starts_dirty) {
+    // nothing new since the index was loaded (or there was nothing to scan)
+    return;
+  }
+
+  // best effort; the slide directory may be read-only
+  char *path = get_mcu_start_index_path(data);
+  FILE *f = _openslide_fopen(path, "wb", NULL);
+  if (f == NULL) {
+    g_free(path);
+    return;
+  }
+
+  bool ok = fwrite(MCU_START_INDEX_MAGIC, sizeof(MCU_START_INDEX_MAGIC),
+                   1, f) == 1 &&
+    write_le_int64(f, MCU_START_INDEX_VERSION) &&
+    write_le_int64(f, data->jpeg_count);
+
+  for (int32_t i = 0; ok && i < data->jpeg_count; i++) {
+    struct one_jpeg *oj = data->all_jpegs[i];
+
+    ok = write_le_int64(f, oj->start_in_file) &&
+      write_le_int64(f, oj->end_in_file) &&
+      write_le_int64(f, oj->mcu_starts_count);
+
+    for (int32_t j = 0; ok && j < oj->mcu_starts_count; j++) {
+      // write the best offset we know for each MCU; a never-touched
+      // file has no mcu_starts array at all
+      int64_t offset = (oj->mcu_starts != NULL) ? oj->mcu_starts[j] : -1;
+      if (offset == -1 && oj->unreliable_mcu_starts != NULL) {
+        offset = oj->unreliable_mcu_starts[j];
+      }
+      ok = write_le_int64(f, offset);
+    }
+  }
+
+  if (fclose(f) || !ok) {
+    // don't leave a truncated index behind
+    remove(path);
+  }
+  g_free(path);
+}
+
+// jpeg mutex must be held
+static void ensure_mcu_starts(struct one_jpeg *jpeg) {
+  if (jpeg->mcu_starts != NULL) {
+    return;
+  }
+
+  jpeg->mcu_starts = g_new(int64_t, jpeg->mcu_starts_count);
+
+  // init all to -1
+  for (int32_t i = 0; i < jpeg->mcu_starts_count; i++) {
+    (jpeg->mcu_starts)[i] = -1;
+  }
+}
+
 static void _compute_mcu_start(openslide_t *osr,
 			       struct one_jpeg *jpeg,
 			       FILE *f,
 			       int64_t target) {
+  struct jpegops_data *data = osr->data;
+
+  ensure_mcu_starts(jpeg);
+
   // special case for first
   if (jpeg->mcu_starts[0] == -1) {
     struct jpeg_decompress_struct cinfo;
@@ -475,6 +788,7 @@ static void _compute_mcu_start(openslide_t *osr,
     } else if (b >= 0xD0 && b < 0xD8) {
       // marker
       jpeg->mcu_starts[1 + first_good++] = after_marker_pos;
+      data->mcu_starts_dirty = true;
     }
   }
 }
@@ -486,9 +800,7 @@ static void compute_mcu_start(openslide_t *osr,
 			      int64_t *header_stop_position,
 			      int64_t *start_position,
 			      int64_t *stop_position) {
-  struct jpegops_data *data = osr->data;
-
-  g_mutex_lock(data->restart_marker_mutex);
+  g_mutex_lock(jpeg->mutex);
 
   _compute_mcu_start(osr, jpeg, f, tileno);
 
@@ -513,7 +825,29 @@ static void compute_mcu_start(openslide_t *osr,
     }
   }
 
-  g_mutex_unlock(data->restart_marker_mutex);
+  g_mutex_unlock(jpeg->mutex);
+}
+
+static GMappedFile *get_mapped_file(openslide_t *osr G_GNUC_UNUSED,
+				    struct one_jpeg *jpeg) {
+  g_mutex_lock(jpeg->mutex);
+  if (jpeg->mapped_file == NULL && !jpeg->mapped_file_failed) {
+    if (_openslide_io_provider_active()) {
+      // the filename may not exist locally; all reads must go
+      // through the provider
+      jpeg->mapped_file_failed = true;
+    } else {
+      jpeg->mapped_file = g_mapped_file_new(jpeg->filename, FALSE, NULL);
+    }
+    if (jpeg->mapped_file == NULL) {
+      // maybe a huge file on a 32-bit machine; quietly use stdio reads
+      jpeg->mapped_file_failed = true;
+    }
+  }
+  GMappedFile *map = jpeg->mapped_file;
+  g_mutex_unlock(jpeg->mutex);
+
+  return map;
 }
 
 static uint32_t *read_from_one_jpeg (openslide_t *osr,
@@ -523,7 +857,7 @@ static uint32_t *read_from_one_jpeg (openslide_t *osr,
 				     int w, int h) {
   GError *tmp_err = NULL;
 
-  uint32_t *dest = g_slice_alloc(w * h * 4);
+  uint32_t *dest = _openslide_cache_alloc(osr->cache, w * h * 4);
 
   // open file
   FILE *f = _openslide_fopen(jpeg->filename, "rb", &tmp_err);
@@ -535,6 +869,10 @@ static uint32_t *read_from_one_jpeg (openslide_t *osr,
     return dest;
   }
 
+  // the decode seeks around a possibly multi-GB file; default
+  // readahead just drags in data we'll never touch
+  _openslide_fadvise(f, 0, 0, _OPENSLIDE_FADVICE_RANDOM);
+
   // begin decompress
   struct jpeg_decompress_struct cinfo;
   struct _openslide_jpeg_error_mgr jerr;
@@ -554,6 +892,14 @@ static uint32_t *read_from_one_jpeg (openslide_t *osr,
                       &start_position,
                       &stop_position);
 
+    // we know exactly which byte ranges the decode will touch; start
+    // them on their way now
+    _openslide_fadvise(f, jpeg->start_in_file,
+                       header_stop_position - jpeg->start_in_file,
+                       _OPENSLIDE_FADVICE_WILLNEED);
+    _openslide_fadvise(f, start_position, stop_position - start_position,
+                       _OPENSLIDE_FADVICE_WILLNEED);
+
     // set error handler, this will longjmp if necessary
     cinfo.err = _openslide_jpeg_set_error_handler(&jerr, &env);
 
@@ -561,6 +907,7 @@ static uint32_t *read_from_one_jpeg (openslide_t *osr,
     jpeg_create_decompress(&cinfo);
 
     jpeg_random_access_src(osr, &cinfo, f,
+			   get_mapped_file(osr, jpeg),
 			   jpeg->start_in_file,
 			   header_stop_position,
 			   start_position,
@@ -632,7 +979,9 @@ static uint32_t *read_from_one_jpeg (openslide_t *osr,
 
   // stop jpeg
   struct my_src_mgr *src = (struct my_src_mgr *) cinfo.src;   // sorry
-  g_slice_free1(src->buffer_size, src->buffer);
+  if (src->buffer) {
+    g_slice_free1(src->buffer_size, src->buffer);
+  }
   jpeg_destroy_decompress(&cinfo);
 
   fclose(f);
@@ -652,13 +1001,17 @@ static void read_tile(openslide_t *osr,
   struct level *l = data->levels + level;
   struct read_region_args *region = arg;
 
-  if ((tile_x >= l->tiles_across) || (tile_y >= l->tiles_down)) {
+  // paint_region deliberately walks into the extra-tile margins, so
+  // tile coordinates can be negative here; reject them before indexing
+  // into the tile grid
+  if ((tile_x < 0) || (tile_y < 0) ||
+      (tile_x >= l->tiles_across) || (tile_y >= l->tiles_down)) {
     //g_debug("too much");
     return;
   }
 
   int64_t tileindex = tile_y * l->tiles_across + tile_x;
-  struct tile *requested_tile = g_hash_table_lookup(l->tiles, &tileindex);
+  struct tile *requested_tile = tile_grid_lookup(l->grid, tileindex);
 
   if (!requested_tile) {
     //    g_debug("no tile at index %" G_GINT64_FORMAT, tileindex);
@@ -688,23 +1041,37 @@ static void read_tile(openslide_t *osr,
 
   // get the jpeg data, possibly from cache
   struct _openslide_cache_entry *cache_entry;
-  uint32_t *tiledata = _openslide_cache_get(cache,
+  uint32_t *tiledata = _openslide_cache_get(cache, osr,
                                             requested_tile->jpegno,
                                             requested_tile->tileno,
                                             level,
                                             &cache_entry);
 
   if (!tiledata) {
+    _openslide_stat_add(&osr->stats.cache_misses, 1);
+    // steer the background scanners toward what's being viewed
+    g_atomic_int_set(&data->restart_marker_hint, requested_tile->jpegno);
     tiledata = read_from_one_jpeg(osr,
 				  requested_tile->jpeg,
 				  requested_tile->tileno,
 				  l->scale_denom,
 				  tw, th);
+    _openslide_stat_add(&osr->stats.tiles_decoded, 1);
+    _openslide_stat_add(&osr->stats.bytes_decoded, tw * th * 4);
 
-    _openslide_cache_put(cache, requested_tile->jpegno, requested_tile->tileno, level,
+    _openslide_cache_put(cache, osr, requested_tile->jpegno,
+			 requested_tile->tileno, level,
 			 tiledata,
 			 tw * th * 4,
 			 &cache_entry);
+  } else {
+    _openslide_stat_add(&osr->stats.cache_hits, 1);
+  }
+
+  // cache-warming call from the decode pool; don't composite
+  if (cr == NULL) {
+    _openslide_cache_entry_unref(cache_entry);
+    return;
   }
 
   // draw it
@@ -832,7 +1199,8 @@ static void paint_region(openslide_t *osr, cairo_t *cr,
 			offset_x, offset_y,
 			l->tile_advance_x,
 			l->tile_advance_y,
-			osr, osr->cache, &region,
+			osr, osr->cache,
+			true, &region,
 			read_tile);
 
   // maybe tell the background thread to resume
@@ -840,21 +1208,144 @@ static void paint_region(openslide_t *osr, cairo_t *cr,
   if (!--data->restart_marker_users) {
     g_timer_start(data->restart_marker_timer);
     //  g_debug("telling thread to awaken");
-    g_cond_signal(data->restart_marker_cond);
+    g_cond_broadcast(data->restart_marker_cond);
   }
   g_mutex_unlock(data->restart_marker_cond_mutex);
 }
 
+static bool read_region_raw(openslide_t *osr, uint32_t *dest,
+			    int64_t stride,
+			    int64_t x, int64_t y,
+			    int32_t level,
+			    int64_t w, int64_t h) {
+  struct jpegops_data *data = osr->data;
+  struct level *l = data->levels + level;
+
+  if (!l->valid_tilesize_hints) {
+    return false;
+  }
+
+  int64_t adv_x = l->tile_advance_x;
+  int64_t adv_y = l->tile_advance_y;
+
+  // request must start on the tile grid and cover whole tiles
+  double ds = openslide_get_level_downsample(osr, level);
+  double ds_x = x / ds;
+  double ds_y = y / ds;
+  int64_t lx = ds_x;
+  int64_t ly = ds_y;
+  if (lx != ds_x || ly != ds_y ||
+      (lx % adv_x) || (ly % adv_y) ||
+      (w % adv_x) || (h % adv_y) ||
+      lx + w > l->pixel_w || ly + h > l->pixel_h) {
+    return false;
+  }
+
+  int64_t start_tile_x = lx / adv_x;
+  int64_t start_tile_y = ly / adv_y;
+  int64_t tiles_x = w / adv_x;
+  int64_t tiles_y = h / adv_y;
+
+  // every tile must exist, exactly fill its grid cell, and sit at its
+  // natural position; otherwise let cairo sort out the seams
+  for (int64_t tile_y = start_tile_y;
+       tile_y < start_tile_y + tiles_y; tile_y++) {
+    for (int64_t tile_x = start_tile_x;
+	 tile_x < start_tile_x + tiles_x; tile_x++) {
+      int64_t tileindex = tile_y * l->tiles_across + tile_x;
+      struct tile *tile = tile_grid_lookup(l->grid, tileindex);
+      if (!tile ||
+	  tile->src_x != 0.0 || tile->src_y != 0.0 ||
+	  tile->dest_offset_x != 0.0 || tile->dest_offset_y != 0.0 ||
+	  tile->w != tile->jpeg->tile_width ||
+	  tile->h != tile->jpeg->tile_height ||
+	  tile->jpeg->tile_width / l->scale_denom != adv_x ||
+	  tile->jpeg->tile_height / l->scale_denom != adv_y) {
+	return false;
+      }
+    }
+  }
+
+  // tell the background thread to pause
+  g_mutex_lock(data->restart_marker_cond_mutex);
+  data->restart_marker_users++;
+  g_mutex_unlock(data->restart_marker_cond_mutex);
+
+  // decode and copy
+  for (int64_t tile_y = start_tile_y;
+       !openslide_get_error(osr) && tile_y < start_tile_y + tiles_y;
+       tile_y++) {
+    for (int64_t tile_x = start_tile_x;
+	 !openslide_get_error(osr) && tile_x < start_tile_x + tiles_x;
+	 tile_x++) {
+      int64_t tileindex = tile_y * l->tiles_across + tile_x;
+      struct tile *tile = tile_grid_lookup(l->grid, tileindex);
+
+      // get the jpeg data, possibly from cache
+      struct _openslide_cache_entry *cache_entry;
+      uint32_t *tiledata = _openslide_cache_get(osr->cache, osr,
+						tile->jpegno,
+						tile->tileno,
+						level,
+						&cache_entry);
+      if (!tiledata) {
+	_openslide_stat_add(&osr->stats.cache_misses, 1);
+	// steer the background scanners toward what's being viewed
+	g_atomic_int_set(&data->restart_marker_hint, tile->jpegno);
+	tiledata = read_from_one_jpeg(osr,
+				      tile->jpeg,
+				      tile->tileno,
+				      l->scale_denom,
+				      adv_x, adv_y);
+	_openslide_stat_add(&osr->stats.tiles_decoded, 1);
+	_openslide_stat_add(&osr->stats.bytes_decoded, adv_x * adv_y * 4);
+	_openslide_cache_put(osr->cache, osr, tile->jpegno, tile->tileno,
+			     level,
+			     tiledata,
+			     adv_x * adv_y * 4,
+			     &cache_entry);
+      } else {
+	_openslide_stat_add(&osr->stats.cache_hits, 1);
+      }
+
+      uint32_t *out = dest +
+	(tile_y - start_tile_y) * adv_y * stride +
+	(tile_x - start_tile_x) * adv_x;
+      for (int64_t row = 0; row < adv_y; row++) {
+	memcpy(out + row * stride, tiledata + row * adv_x, adv_x * 4);
+      }
+
+      _openslide_cache_entry_unref(cache_entry);
+    }
+  }
+
+  // maybe tell the background thread to resume
+  g_mutex_lock(data->restart_marker_cond_mutex);
+  if (!--data->restart_marker_users) {
+    g_timer_start(data->restart_marker_timer);
+    g_cond_broadcast(data->restart_marker_cond);
+  }
+  g_mutex_unlock(data->restart_marker_cond_mutex);
+
+  return true;
+}
+
+
 static void destroy(openslide_t *osr) {
   struct jpegops_data *data = osr->data;
 
-  // tell the thread to finish and wait
+  // tell the threads to finish and wait
   g_mutex_lock(data->restart_marker_cond_mutex);
   g_warn_if_fail(data->restart_marker_users == 0);
   data->restart_marker_thread_stop = true;
-  g_cond_signal(data->restart_marker_cond);
+  g_cond_broadcast(data->restart_marker_cond);
   g_mutex_unlock(data->restart_marker_cond_mutex);
-  g_thread_join(data->restart_marker_thread);
+  for (int32_t i = 0; i < data->restart_marker_thread_count; i++) {
+    g_thread_join(data->restart_marker_threads[i]);
+  }
+
+  // persist discovered restart markers for the next open
+  save_mcu_start_index(data);
 
   // each jpeg in turn
   for (int32_t i = 0; i < data->jpeg_count; i++) {
@@ -862,6 +1353,10 @@ static void destroy(openslide_t *osr) {
     g_free(jpeg->filename);
     g_free(jpeg->mcu_starts);
     g_free(jpeg->unreliable_mcu_starts);
+    if (jpeg->mapped_file) {
+      g_mapped_file_unref(jpeg->mapped_file);
+    }
+    g_mutex_free(jpeg->mutex);
     g_slice_free(struct one_jpeg, jpeg);
   }
 
@@ -869,8 +1364,7 @@ static void destroy(openslide_t *osr) {
   for (int32_t i = 0; i < osr->level_count; i++) {
     struct level *l = data->levels + i;
 
-    //    g_debug("g_free(%p)", l->level_jpegs);
-    g_hash_table_unref(l->tiles);
+    tile_grid_unref(l->grid);
   }
 
   // the JPEG array
@@ -880,7 +1374,7 @@ static void destroy(openslide_t *osr) {
   g_free(data->levels);
 
   // the background stuff
-  g_mutex_free(data->restart_marker_mutex);
+  g_free(data->marker_scanned);
   g_timer_destroy(data->restart_marker_timer);
   g_cond_free(data->restart_marker_cond);
   g_mutex_free(data->restart_marker_cond_mutex);
@@ -919,6 +1413,7 @@ static const struct _openslide_ops jpeg_ops = {
   .get_dimensions = get_dimensions,
   .get_tile_geometry = get_tile_geometry,
   .paint_region = paint_region,
+  .read_region_raw = read_region_raw,
   .destroy = destroy,
 };
 
@@ -930,6 +1425,7 @@ static void init_one_jpeg(struct one_jpeg *onej,
   onej->start_in_file = file->start_in_file;
   onej->end_in_file = file->end_in_file;
   onej->unreliable_mcu_starts = file->mcu_starts;
+  onej->mutex = g_mutex_new();
 
   g_assert(file->w && file->h && file->tw && file->th);
 
@@ -943,13 +1439,9 @@ static void init_one_jpeg(struct one_jpeg *onej,
     (onej->width / onej->tile_width) *
     (onej->height / onej->tile_height);
 
-  onej->mcu_starts = g_new(int64_t,
-			   onej->mcu_starts_count);
-
-  // init all to -1
-  for (int32_t i = 0; i < onej->mcu_starts_count; i++) {
-    (onej->mcu_starts)[i] = -1;
-  }
+  // the array itself is created on first use; a slide can reference
+  // hundreds of files the user never looks at
+  onej->mcu_starts = NULL;
 }
 
 static gint width_compare(gconstpointer a, gconstpointer b) {
@@ -1001,18 +1493,35 @@ static void verify_mcu_starts(struct jpegops_data *data) {
   }
 }
 
+// claim the next file to scan, starting from the file backing the most
+// recent decode so the level the user is looking at is indexed first.
+// returns -1 when every file is claimed
+// cond mutex must be held
+static int32_t next_marker_jpeg(struct jpegops_data *data) {
+  int32_t hint = g_atomic_int_get(&data->restart_marker_hint);
+
+  for (int32_t i = 0; i < data->jpeg_count; i++) {
+    int32_t j = (hint + i) % data->jpeg_count;
+    if (!data->marker_scanned[j]) {
+      data->marker_scanned[j] = true;
+      return j;
+    }
+  }
+  return -1;
+}
+
 static gpointer restart_marker_thread_func(gpointer d) {
   openslide_t *osr = d;
   struct jpegops_data *data = osr->data;
 
-  int32_t current_jpeg = 0;
+  int32_t current_jpeg = -1;
   int32_t current_mcu_start = 0;
 
   FILE *current_file = NULL;
 
   GError *tmp_err = NULL;
 
-  while(current_jpeg < data->jpeg_count) {
+  while(true) {
     g_mutex_lock(data->restart_marker_cond_mutex);
 
     // should we pause?
@@ -1049,6 +1558,17 @@ static gpointer restart_marker_thread_func(gpointer d) {
       continue;
     }
 
+    // claim a file if we aren't working on one
+    if (current_jpeg == -1) {
+      current_jpeg = next_marker_jpeg(data);
+      current_mcu_start = 0;
+      if (current_jpeg == -1) {
+	// nothing left to scan
+	g_mutex_unlock(data->restart_marker_cond_mutex);
+	break;
+      }
+    }
+
     // we are finally able to run
     g_mutex_unlock(data->restart_marker_cond_mutex);
 
@@ -1065,6 +1585,9 @@ static gpointer restart_marker_thread_func(gpointer d) {
 	  g_clear_error(&tmp_err);
 	  break;
 	}
+	// the scan walks the file front to back
+	_openslide_fadvise(current_file, 0, 0,
+			   _OPENSLIDE_FADVICE_SEQUENTIAL);
       }
 
       compute_mcu_start(osr, oj, current_file, current_mcu_start,
@@ -1076,16 +1599,19 @@ static gpointer restart_marker_thread_func(gpointer d) {
 
       current_mcu_start++;
       if (current_mcu_start >= oj->mcu_starts_count) {
-	current_mcu_start = 0;
-	current_jpeg++;
+	current_jpeg = -1;
 	fclose(current_file);
 	current_file = NULL;
       }
     } else {
-      current_jpeg++;
+      current_jpeg = -1;
     }
   }
 
+  if (current_file != NULL) {
+    fclose(current_file);
+  }
+
   //  g_debug("restart_marker_thread_func done!");
   return NULL;
 }
@@ -1192,11 +1718,12 @@ void _openslide_add_jpeg_ops(openslide_t *osr,
     new_l->tile_advance_y = old_l->tile_advance_y;
 
     // convert tiles
-    new_l->tiles = g_hash_table_new_full(_openslide_int64_hash,
-					 _openslide_int64_equal,
-					 _openslide_int64_free, tile_free);
-    struct convert_tiles_args ct_args = { new_l, data->all_jpegs };
+    new_l->grid = tile_grid_create((int64_t) old_l->tiles_across *
+				   old_l->tiles_down,
+				   g_hash_table_size(old_l->tiles));
+    struct convert_tiles_args ct_args = { new_l, data->all_jpegs, 0 };
     g_hash_table_foreach(old_l->tiles, convert_tiles, &ct_args);
+    new_l->grid->record_count = ct_args.next_record;
 
     //g_debug("level margins %d %d %d %d", new_l->extra_tiles_top, new_l->extra_tiles_left, new_l->extra_tiles_bottom, new_l->extra_tiles_right);
 
@@ -1205,7 +1732,10 @@ void _openslide_add_jpeg_ops(openslide_t *osr,
     *key = new_l->pixel_w;
     g_hash_table_insert(expanded_levels, key, new_l);
 
-    // try adding scale_denom levels
+    // try adding scale_denom levels.  These decode with libjpeg's
+    // scale_denom set (read_from_one_jpeg), so overview rendering pays
+    // for 1/4, 1/16 or 1/64 of the IDCT work, and the reduced tiles are
+    // cached under their own level index
     for (int scale_denom = 2; scale_denom <= 8; scale_denom <<= 1) {
       // check to make sure we get an even division
       if ((old_l->raw_tile_width % scale_denom) ||
@@ -1215,7 +1745,7 @@ void _openslide_add_jpeg_ops(openslide_t *osr,
 
       // create a derived level
       struct level *sd_l = g_slice_new0(struct level);
-      sd_l->tiles = g_hash_table_ref(new_l->tiles);
+      sd_l->grid = tile_grid_ref(new_l->grid);
       sd_l->tiles_across = new_l->tiles_across;
       sd_l->tiles_down = new_l->tiles_down;
       sd_l->downsample = new_l->downsample * scale_denom;
@@ -1252,6 +1782,9 @@ void _openslide_add_jpeg_ops(openslide_t *osr,
   // when background finding mcus
   qsort(data->all_jpegs, file_count, sizeof(struct one_jpeg *), one_jpeg_compare);
 
+  // merge in restart markers found by a previous open, if any
+  load_mcu_start_index(data);
+
   // get sorted keys
   GList *level_keys = NULL;
   g_hash_table_foreach(expanded_levels, get_keys, &level_keys);
@@ -1297,19 +1830,26 @@ void _openslide_add_jpeg_ops(openslide_t *osr,
   g_hash_table_unref(expanded_levels);
 
 
-  // init background thread for finding restart markers
+  // init background threads for finding restart markers
   data->restart_marker_timer = g_timer_new();
-  data->restart_marker_mutex = g_mutex_new();
   data->restart_marker_cond = g_cond_new();
   data->restart_marker_cond_mutex = g_mutex_new();
-  data->restart_marker_thread = g_thread_create(restart_marker_thread_func,
-						osr,
-						TRUE,
-						NULL);
+  data->marker_scanned = g_new0(bool, data->jpeg_count);
+  data->restart_marker_thread_count = MIN(data->jpeg_count,
+					  RESTART_MARKER_THREAD_COUNT);
+  for (int32_t i = 0; i < data->restart_marker_thread_count; i++) {
+    data->restart_marker_threads[i] = g_thread_create(restart_marker_thread_func,
+						      osr,
+						      TRUE,
+						      NULL);
+  }
 
   // for debugging
   if (false) {
-    g_thread_join(data->restart_marker_thread);
+    for (int32_t i = 0; i < data->restart_marker_thread_count; i++) {
+      g_thread_join(data->restart_marker_threads[i]);
+    }
+    data->restart_marker_thread_count = 0;
     verify_mcu_starts(data);
   }
 
@@ -1365,10 +1905,12 @@ GHashTable *_openslide_jpeg_create_tiles_table(void) {
 			       struct_openslide_jpeg_tile_free);
 }
 
-static void jpeg_get_associated_image_data(openslide_t *osr, void *_ctx,
-                                           uint32_t *_dest,
-                                           int64_t w, int64_t h) {
-  struct jpeg_associated_image_ctx *ctx = _ctx;
+static void jpeg_read_associated_image(openslide_t *osr,
+                                       struct jpeg_associated_image_ctx *ctx,
+                                       uint32_t *_dest,
+                                       int64_t w, int64_t h,
+                                       unsigned int scale_denom,
+                                       int64_t *got_w, int64_t *got_h) {
   struct jpeg_decompress_struct cinfo;
   struct _openslide_jpeg_error_mgr jerr;
   FILE *f;
@@ -1409,16 +1951,25 @@ static void jpeg_get_associated_image_data(openslide_t *osr, void *_ctx,
     }
 
     cinfo.out_color_space = JCS_RGB;
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = scale_denom;
 
     jpeg_start_decompress(&cinfo);
 
     // ensure dimensions have not changed
     int32_t width = cinfo.output_width;
     int32_t height = cinfo.output_height;
-    if (w != width || h != height) {
+    if ((w + scale_denom - 1) / scale_denom != width ||
+        (h + scale_denom - 1) / scale_denom != height) {
       _openslide_set_error(osr, "Unexpected associated image size");
       goto DONE;
     }
+    if (got_w) {
+      *got_w = width;
+    }
+    if (got_h) {
+      *got_h = height;
+    }
 
     // allocate scanline buffers
     for (int i = 0; i < cinfo.rec_outbuf_height; i++) {
@@ -1470,6 +2021,32 @@ DONE:
   fclose(f);
 }
 
+static void jpeg_get_associated_image_data(openslide_t *osr, void *_ctx,
+                                           uint32_t *dest,
+                                           int64_t w, int64_t h) {
+  jpeg_read_associated_image(osr, _ctx, dest, w, h, 1, NULL, NULL);
+}
+
+static void jpeg_get_associated_image_data_scaled(openslide_t *osr,
+                                                  void *_ctx,
+                                                  uint32_t *dest,
+                                                  int64_t w, int64_t h,
+                                                  int64_t target_w,
+                                                  int64_t target_h,
+                                                  int64_t *got_w,
+                                                  int64_t *got_h) {
+  // pick the largest denominator that doesn't undershoot the target
+  unsigned int scale_denom = 8;
+  while (scale_denom > 1 &&
+         ((w + scale_denom - 1) / scale_denom < target_w ||
+          (h + scale_denom - 1) / scale_denom < target_h)) {
+    scale_denom /= 2;
+  }
+
+  jpeg_read_associated_image(osr, _ctx, dest, w, h, scale_denom,
+                             got_w, got_h);
+}
+
 static void jpeg_destroy_associated_image_ctx(void *_ctx) {
   struct jpeg_associated_image_ctx *ctx = _ctx;
 
@@ -1523,11 +2100,12 @@ bool _openslide_add_jpeg_associated_image(GHashTable *ht,
       ctx->offset = offset;
 
       struct _openslide_associated_image *aimg =
-	g_slice_new(struct _openslide_associated_image);
+	g_slice_new0(struct _openslide_associated_image);
       aimg->w = cinfo.output_width;
       aimg->h = cinfo.output_height;
       aimg->ctx = ctx;
       aimg->get_argb_data = jpeg_get_associated_image_data;
+      aimg->get_argb_data_scaled = jpeg_get_associated_image_data_scaled;
       aimg->destroy_ctx = jpeg_destroy_associated_image_ctx;
 
       g_hash_table_insert(ht, g_strdup(name), aimg);
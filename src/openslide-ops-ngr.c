@@ -25,12 +25,19 @@
 #include "openslide-private.h"
 #include "openslide-cache.h"
 #include "openslide-tilehelper.h"
+#include "openslide-pixelops.h"
 
 #include <string.h>
 #include <stdint.h>
 #include <math.h>
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <cairo.h>
+#include <fcntl.h>
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
 
 #define NGR_TILE_HEIGHT 64
 
@@ -42,12 +49,57 @@ struct ngr_data {
 
 static void destroy_ngrs(struct _openslide_ngr **ngrs, int count) {
   for (int i = 0; i < count; i++) {
+#ifdef HAVE_PREAD
+    if (ngrs[i]->fd != -1) {
+      close(ngrs[i]->fd);
+    }
+#endif
     g_free(ngrs[i]->filename);
     g_slice_free(struct _openslide_ngr, ngrs[i]);
   }
   g_free(ngrs);
 }
 
+// read a column strip, preferring the persistent descriptor.  pread()
+// carries no seek state, so concurrent tile decodes don't interfere
+static bool ngr_read(struct _openslide_ngr *ngr,
+		     void *buf, int64_t size, int64_t offset,
+		     GError **err) {
+#ifdef HAVE_PREAD
+  if (ngr->fd != -1) {
+    char *p = buf;
+    int64_t left = size;
+    while (left > 0) {
+      ssize_t count = pread(ngr->fd, p, left, offset);
+      if (count <= 0) {
+	g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_BAD_DATA,
+		    "Cannot read file %s", ngr->filename);
+	return false;
+      }
+      p += count;
+      offset += count;
+      left -= count;
+    }
+    return true;
+  }
+#endif
+
+  // no persistent descriptor; fall back to open-per-read
+  FILE *f = _openslide_fopen(ngr->filename, "rb", err);
+  if (!f) {
+    return false;
+  }
+  if (fseeko(f, offset, SEEK_SET) == -1 ||
+      fread(buf, size, 1, f) != 1) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_BAD_DATA,
+		"Cannot read file %s", ngr->filename);
+    fclose(f);
+    return false;
+  }
+  fclose(f);
+  return true;
+}
+
 static void destroy(openslide_t *osr) {
   struct ngr_data *data = osr->data;
 
@@ -99,17 +151,11 @@ static void read_tile(openslide_t *osr,
   int tilesize = tw * th * 4;
   struct _openslide_cache_entry *cache_entry;
   // look up tile in cache
-  uint32_t *tiledata = _openslide_cache_get(cache, tile_x, tile_y, level,
+  uint32_t *tiledata = _openslide_cache_get(cache, osr, tile_x, tile_y, level,
                                             &cache_entry);
 
   if (!tiledata) {
-    // read the tile data
-    FILE *f = _openslide_fopen(ngr->filename, "rb", &tmp_err);
-    if (!f) {
-      _openslide_set_error_from_gerror(osr, tmp_err);
-      g_clear_error(&tmp_err);
-      return;
-    }
+    _openslide_stat_add(&osr->stats.cache_misses, 1);
 
     // compute offset to read
     int64_t offset = ngr->start_in_file +
@@ -117,38 +163,40 @@ static void read_tile(openslide_t *osr,
       (tile_x * ngr->h * ngr->column_width * 6);
     //    g_debug("tile_x: %" G_GINT64_FORMAT ", "
     //	    "tile_y: %" G_GINT64_FORMAT ", "
-    //	    "seeking to %" G_GINT64_FORMAT, tile_x, tile_y, offset);
-    fseeko(f, offset, SEEK_SET);
+    //	    "reading at %" G_GINT64_FORMAT, tile_x, tile_y, offset);
 
     // alloc and read
     int buf_size = tw * th * 6;
     uint16_t *buf = g_slice_alloc(buf_size);
 
-    if (fread(buf, buf_size, 1, f) != 1) {
-      _openslide_set_error(osr, "Cannot read file %s", ngr->filename);
-      fclose(f);
+    if (!ngr_read(ngr, buf, buf_size, offset, &tmp_err)) {
+      _openslide_set_error_from_gerror(osr, tmp_err);
+      g_clear_error(&tmp_err);
       g_slice_free1(buf_size, buf);
       return;
     }
-    fclose(f);
 
     // got the data, now convert to 8-bit xRGB
-    tiledata = g_slice_alloc(tilesize);
-    for (int i = 0; i < tw * th; i++) {
-      // scale down from 12 bits
-      uint8_t r = GINT16_FROM_LE(buf[(i * 3)]) >> 4;
-      uint8_t g = GINT16_FROM_LE(buf[(i * 3) + 1]) >> 4;
-      uint8_t b = GINT16_FROM_LE(buf[(i * 3) + 2]) >> 4;
-
-      tiledata[i] = (r << 16) | (g << 8) | b;
-    }
+    tiledata = _openslide_cache_alloc(cache, tilesize);
+    _openslide_pixelops_rgb12_to_argb(buf, tiledata, tw * th);
     g_slice_free1(buf_size, buf);
 
+    _openslide_stat_add(&osr->stats.tiles_decoded, 1);
+    _openslide_stat_add(&osr->stats.bytes_decoded, tilesize);
+
     // put it in the cache
-    _openslide_cache_put(cache, tile_x, tile_y, level,
+    _openslide_cache_put(cache, osr, tile_x, tile_y, level,
                          tiledata,
                          tilesize,
                          &cache_entry);
+  } else {
+    _openslide_stat_add(&osr->stats.cache_hits, 1);
+  }
+
+  // cache-warming call from the decode pool; don't composite
+  if (cr == NULL) {
+    _openslide_cache_entry_unref(cache_entry);
+    return;
   }
 
   // draw it
@@ -192,7 +240,8 @@ static void paint_region(openslide_t *osr, cairo_t *cr,
 			end_tile_x, end_tile_y,
 			offset_x, offset_y,
 			ngr->column_width, NGR_TILE_HEIGHT,
-			osr, osr->cache, NULL,
+			osr, osr->cache,
+			true, NULL,
 			read_tile);
 }
 
@@ -220,6 +269,21 @@ void _openslide_add_ngr_ops(openslide_t *osr,
   data->ngr_count = ngr_count;
   data->ngrs = ngrs;
 
+#ifdef HAVE_PREAD
+  // open a persistent descriptor per file; on failure, read_tile falls
+  // back to opening the file for each read
+  for (int32_t i = 0; i < ngr_count; i++) {
+    ngrs[i]->fd = g_open(ngrs[i]->filename, O_RDONLY, 0);
+#ifdef HAVE_FCNTL
+    if (ngrs[i]->fd != -1) {
+      fcntl(ngrs[i]->fd, F_SETFD, FD_CLOEXEC);
+    }
+#endif
+    // column strips are long sequential runs; let the kernel read ahead
+    _openslide_fadvise_fd(ngrs[i]->fd, 0, 0, _OPENSLIDE_FADVICE_SEQUENTIAL);
+  }
+#endif
+
   // store vmu-specific data into osr
   g_assert(osr->data == NULL);
   osr->data = data;
@@ -34,6 +34,7 @@
 
 #include "openslide-tilehelper.h"
 #include "openslide-hash.h"
+#include "openslide-pixelops.h"
 
 #define HANDLE_CACHE_MAX 32
 
@@ -309,44 +310,25 @@ static void get_tile_geometry(openslide_t *osr, int32_t level,
   put_tiff(osr, tiff);
 }
 
-static void read_tile(openslide_t *osr,
-		      cairo_t *cr,
-		      int32_t level,
-		      int64_t tile_x, int64_t tile_y,
-		      double translate_x, double translate_y,
-		      struct _openslide_cache *cache,
-		      void *arg) {
+// look up a tile in the cache, decoding (and clipping, for edge tiles)
+// on a miss.  The caller owns a reference on *cache_entry.
+static uint32_t *get_tile_data(openslide_t *osr, TIFF *tiff,
+                               int32_t level,
+                               int64_t x, int64_t y,
+                               int64_t tw, int64_t th,
+                               int64_t iw, int64_t ih,
+                               struct _openslide_cache *cache,
+                               struct _openslide_cache_entry **cache_entry) {
   struct _openslide_tiffopsdata *data = osr->data;
-  TIFF *tiff = arg;
-
-  uint32_t tmp;
 
-  // set the level
-  SET_DIR_OR_FAIL(osr, tiff, data->levels[level])
-
-  // figure out tile size
-  int64_t tw, th;
-  GET_FIELD_OR_FAIL(osr, tiff, TIFFTAG_TILEWIDTH, tw)
-  GET_FIELD_OR_FAIL(osr, tiff, TIFFTAG_TILELENGTH, th)
-
-  // get image size
-  int64_t iw, ih;
-  GET_FIELD_OR_FAIL(osr, tiff, TIFFTAG_IMAGEWIDTH, iw)
-  GET_FIELD_OR_FAIL(osr, tiff, TIFFTAG_IMAGELENGTH, ih)
-
-  int64_t x = tile_x * tw;
-  int64_t y = tile_y * th;
-
-  if ((x >= iw) || (y >= ih)) {
-    return;
-  }
-
-  // cache
-  struct _openslide_cache_entry *cache_entry;
-  uint32_t *tiledata = _openslide_cache_get(cache, x, y, level, &cache_entry);
+  uint32_t *tiledata = _openslide_cache_get(cache, osr, x, y, level,
+					    cache_entry);
   if (!tiledata) {
-    tiledata = g_slice_alloc(tw * th * 4);
+    _openslide_stat_add(&osr->stats.cache_misses, 1);
+    tiledata = _openslide_cache_alloc(cache, tw * th * 4);
     data->tileread(osr, tiff, tiledata, x, y, tw, th);
+    _openslide_stat_add(&osr->stats.tiles_decoded, 1);
+    _openslide_stat_add(&osr->stats.bytes_decoded, tw * th * 4);
 
     // clip, if necessary
     int64_t rx = iw - x;
@@ -372,9 +354,57 @@ static void read_tile(openslide_t *osr,
     }
 
     // put it in the cache
-    _openslide_cache_put(cache, x, y, level,
+    _openslide_cache_put(cache, osr, x, y, level,
 			 tiledata, tw * th * 4,
-			 &cache_entry);
+			 cache_entry);
+  } else {
+    _openslide_stat_add(&osr->stats.cache_hits, 1);
+  }
+
+  return tiledata;
+}
+
+static void _read_tile(openslide_t *osr,
+		       TIFF *tiff,
+		       cairo_t *cr,
+		       int32_t level,
+		       int64_t tile_x, int64_t tile_y,
+		       double translate_x, double translate_y,
+		       struct _openslide_cache *cache) {
+  struct _openslide_tiffopsdata *data = osr->data;
+
+  uint32_t tmp;
+
+  // set the level
+  SET_DIR_OR_FAIL(osr, tiff, data->levels[level])
+
+  // figure out tile size
+  int64_t tw, th;
+  GET_FIELD_OR_FAIL(osr, tiff, TIFFTAG_TILEWIDTH, tw)
+  GET_FIELD_OR_FAIL(osr, tiff, TIFFTAG_TILELENGTH, th)
+
+  // get image size
+  int64_t iw, ih;
+  GET_FIELD_OR_FAIL(osr, tiff, TIFFTAG_IMAGEWIDTH, iw)
+  GET_FIELD_OR_FAIL(osr, tiff, TIFFTAG_IMAGELENGTH, ih)
+
+  int64_t x = tile_x * tw;
+  int64_t y = tile_y * th;
+
+  if ((x >= iw) || (y >= ih)) {
+    return;
+  }
+
+  // cache
+  struct _openslide_cache_entry *cache_entry;
+  uint32_t *tiledata = get_tile_data(osr, tiff, level, x, y,
+                                     tw, th, iw, ih,
+                                     cache, &cache_entry);
+
+  // cache-warming call from the decode pool; don't composite
+  if (cr == NULL) {
+    _openslide_cache_entry_unref(cache_entry);
+    return;
   }
 
   // draw it
@@ -417,6 +447,23 @@ static void read_tile(openslide_t *osr,
   _openslide_cache_entry_unref(cache_entry);
 }
 
+static void read_tile(openslide_t *osr,
+		      cairo_t *cr,
+		      int32_t level,
+		      int64_t tile_x, int64_t tile_y,
+		      double translate_x, double translate_y,
+		      struct _openslide_cache *cache,
+		      void *arg G_GNUC_UNUSED) {
+  // check out a handle per tile, so concurrent decodes don't serialize
+  // on one handle and region painting doesn't pin one for its duration
+  TIFF *tiff = get_tiff(osr);
+  if (tiff) {
+    _read_tile(osr, tiff, cr, level, tile_x, tile_y,
+               translate_x, translate_y, cache);
+  }
+  put_tiff(osr, tiff);
+}
+
 static void _paint_region(openslide_t *osr, TIFF *tiff, cairo_t *cr,
                           int64_t x, int64_t y,
                           int32_t level,
@@ -486,12 +533,15 @@ static void _paint_region(openslide_t *osr, TIFF *tiff, cairo_t *cr,
     }
   }
 
+  // each read_tile call checks out its own handle, so concurrent
+  // decoding is safe
   _openslide_read_tiles(cr, level,
 			start_tile_x, start_tile_y,
 			end_tile_x, end_tile_y,
 			offset_x, offset_y,
 			advance_x, advance_y,
-			osr, osr->cache, tiff,
+			osr, osr->cache,
+			true, NULL,
 			read_tile);
 }
 
@@ -506,11 +556,118 @@ static void paint_region(openslide_t *osr, cairo_t *cr,
   put_tiff(osr, tiff);
 }
 
+static bool _read_region_raw(openslide_t *osr, TIFF *tiff,
+                             uint32_t *dest, int64_t stride,
+                             int64_t x, int64_t y,
+                             int32_t level,
+                             int64_t w, int64_t h) {
+  struct _openslide_tiffopsdata *data = osr->data;
+  uint32_t tmp;
+
+  // overlaps mean fractional tile advances; leave those to cairo
+  for (int32_t i = 0; i < 2 * data->overlap_count; i++) {
+    if (data->overlaps[i]) {
+      return false;
+    }
+  }
+
+  // decline quietly on TIFF trouble; the cairo fallback will surface
+  // the error
+  if (!TIFFSetDirectory(tiff, data->levels[level])) {
+    return false;
+  }
+
+  int64_t tw, th, iw, ih;
+  if (!TIFFGetField(tiff, TIFFTAG_TILEWIDTH, &tmp)) {
+    return false;
+  }
+  tw = tmp;
+  if (!TIFFGetField(tiff, TIFFTAG_TILELENGTH, &tmp)) {
+    return false;
+  }
+  th = tmp;
+  if (!TIFFGetField(tiff, TIFFTAG_IMAGEWIDTH, &tmp)) {
+    return false;
+  }
+  iw = tmp;
+  if (!TIFFGetField(tiff, TIFFTAG_IMAGELENGTH, &tmp)) {
+    return false;
+  }
+  ih = tmp;
+
+  // the request must map onto integer coordinates in this level
+  double ds = openslide_get_level_downsample(osr, level);
+  double ds_x = x / ds;
+  double ds_y = y / ds;
+  int64_t sx = ds_x;
+  int64_t sy = ds_y;
+  if (sx != ds_x || sy != ds_y) {
+    return false;
+  }
+
+  // pixels beyond the level edge stay transparent; the caller has
+  // already cleared dest
+  if (sx >= iw || sy >= ih) {
+    return true;
+  }
+  int64_t end_x = MIN(sx + w, iw);
+  int64_t end_y = MIN(sy + h, ih);
+
+  // copy the intersecting rows of each covered tile straight into dest,
+  // skipping cairo compositing entirely
+  for (int64_t ty = sy / th; ty * th < end_y; ty++) {
+    for (int64_t tx = sx / tw; tx * tw < end_x; tx++) {
+      struct _openslide_cache_entry *cache_entry;
+      uint32_t *tiledata = get_tile_data(osr, tiff, level,
+                                         tx * tw, ty * th,
+                                         tw, th, iw, ih,
+                                         osr->cache, &cache_entry);
+
+      int64_t cx0 = MAX(sx, tx * tw);
+      int64_t cy0 = MAX(sy, ty * th);
+      int64_t cx1 = MIN(end_x, (tx + 1) * tw);
+      int64_t cy1 = MIN(end_y, (ty + 1) * th);
+      for (int64_t row = cy0; row < cy1; row++) {
+	memcpy(dest + (row - sy) * stride + (cx0 - sx),
+	       tiledata + (row - ty * th) * tw + (cx0 - tx * tw),
+	       (cx1 - cx0) * 4);
+      }
+
+      _openslide_cache_entry_unref(cache_entry);
+
+      if (openslide_get_error(osr)) {
+	// claim the request; the caller clears dest on error
+	return true;
+      }
+    }
+  }
+
+  return true;
+}
+
+static bool read_region_raw(openslide_t *osr, uint32_t *dest,
+                            int64_t stride,
+                            int64_t x, int64_t y,
+                            int32_t level,
+                            int64_t w, int64_t h) {
+  TIFF *tiff = get_tiff(osr);
+  if (tiff == NULL) {
+    // get_tiff already set the error; claim the request so the caller
+    // clears dest instead of retrying through cairo
+    return true;
+  }
+  bool result = _read_region_raw(osr, tiff, dest, stride,
+                                 x, y, level, w, h);
+  put_tiff(osr, tiff);
+  return result;
+}
+
 
 static const struct _openslide_ops _openslide_tiff_ops = {
   .get_dimensions = get_dimensions,
   .get_tile_geometry = get_tile_geometry,
   .paint_region = paint_region,
+  .read_region_raw = read_region_raw,
   .destroy = destroy,
 };
 
@@ -594,14 +751,7 @@ void _openslide_generic_tiff_tilereader(openslide_t *osr,
   // draw it
   if (TIFFRGBAImageGet(&img, dest, w, h)) {
     // permute
-    uint32_t *p = dest;
-    uint32_t *end = dest + w * h;
-    while (p < end) {
-      uint32_t val = *p;
-      *p++ = (val & 0xFF00FF00)
-	| ((val << 16) & 0xFF0000)
-	| ((val >> 16) & 0xFF);
-    }
+    _openslide_pixelops_swizzle_rgba(dest, (int64_t) w * h);
   } else {
     _openslide_set_error(osr, "TIFFRGBAImageGet failed: %s", emsg);
     memset(dest, 0, w * h * 4);
@@ -680,7 +830,7 @@ bool _openslide_add_tiff_associated_image(GHashTable *ht,
     ctx->directory = TIFFCurrentDirectory(tiff);
 
     struct _openslide_associated_image *aimg =
-      g_slice_new(struct _openslide_associated_image);
+      g_slice_new0(struct _openslide_associated_image);
     aimg->w = w;
     aimg->h = h;
     aimg->ctx = ctx;
@@ -703,6 +853,9 @@ static tsize_t tiff_do_read(thandle_t th, tdata_t buf, tsize_t size) {
   if (f == NULL) {
     return 0;
   }
+  // tile fetches are small and scattered; don't let the kernel read
+  // ahead past them
+  _openslide_fadvise(f, 0, 0, _OPENSLIDE_FADVICE_RANDOM);
   if (fseeko(f, hdl->offset, SEEK_SET)) {
     fclose(f);
     return 0;
@@ -0,0 +1,165 @@
+/*
+ *  OpenSlide, a library for reading whole slide image files
+ *
+ *  Copyright (c) 2007-2013 Carnegie Mellon University
+ *  All rights reserved.
+ *
+ *  OpenSlide is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, version 2.1.
+ *
+ *  OpenSlide is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with OpenSlide. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * SSSE3 pixel kernels.  This file is compiled with -mssse3; callers
+ * must verify CPU support before invoking anything in here (see
+ * openslide-pixelops.c).
+ */
+
+#include <config.h>
+
+#include "openslide-pixelops.h"
+
+#include <glib.h>
+#include <tmmintrin.h>
+
+void _openslide_pixelops_swizzle_rgba_ssse3(uint32_t *buf, int64_t count) {
+  // swap the R and B bytes of each 32-bit pixel
+  const __m128i shuffle = _mm_set_epi8(15, 12, 13, 14,
+                                       11, 8, 9, 10,
+                                       7, 4, 5, 6,
+                                       3, 0, 1, 2);
+
+  uint32_t *p = buf;
+  uint32_t *vec_end = buf + (count & ~3);
+  uint32_t *end = buf + count;
+
+  while (p < vec_end) {
+    __m128i val = _mm_loadu_si128((__m128i *) p);
+    _mm_storeu_si128((__m128i *) p, _mm_shuffle_epi8(val, shuffle));
+    p += 4;
+  }
+
+  // tail
+  while (p < end) {
+    uint32_t val = *p;
+    *p++ = (val & 0xFF00FF00)
+      | ((val << 16) & 0xFF0000)
+      | ((val >> 16) & 0xFF);
+  }
+}
+
+void _openslide_pixelops_ycbcr_to_argb_ssse3(const int32_t *y,
+					     const int32_t *cb,
+					     const int32_t *cr,
+					     uint32_t *dest, int64_t count) {
+  // fixed-point JFIF coefficients scaled by 2^13; see the scalar
+  // version in openslide-pixelops.c
+  const __m128i c128 = _mm_set1_epi16(128);
+  const __m128i coeff_r = _mm_set_epi16(11485, 8192, 11485, 8192,
+					11485, 8192, 11485, 8192);
+  const __m128i coeff_g = _mm_set_epi16(-2819, 8192, -2819, 8192,
+					-2819, 8192, -2819, 8192);
+  const __m128i coeff_g2 = _mm_set1_epi16(-5850);
+  const __m128i coeff_b = _mm_set_epi16(14516, 8192, 14516, 8192,
+					14516, 8192, 14516, 8192);
+  const __m128i alpha = _mm_set1_epi32(255);
+  // interleave [R0-3, G0-3, B0-3, A0-3] bytes into 4 ARGB words
+  const __m128i interleave = _mm_set_epi8(15, 3, 7, 11,
+					  14, 2, 6, 10,
+					  13, 1, 5, 9,
+					  12, 0, 4, 8);
+
+  int64_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    // narrow the planes to 16 bits and center the chroma
+    __m128i y16 = _mm_packs_epi32(_mm_loadu_si128((const __m128i *) (y + i)),
+				  _mm_setzero_si128());
+    __m128i cb16 = _mm_sub_epi16(
+	_mm_packs_epi32(_mm_loadu_si128((const __m128i *) (cb + i)),
+			_mm_setzero_si128()), c128);
+    __m128i cr16 = _mm_sub_epi16(
+	_mm_packs_epi32(_mm_loadu_si128((const __m128i *) (cr + i)),
+			_mm_setzero_si128()), c128);
+
+    // pair (Y, Cr) and (Y, Cb) for multiply-accumulate
+    __m128i ycr = _mm_unpacklo_epi16(y16, cr16);
+    __m128i ycb = _mm_unpacklo_epi16(y16, cb16);
+    __m128i cr0 = _mm_unpacklo_epi16(cr16, _mm_setzero_si128());
+
+    __m128i r32 = _mm_srai_epi32(_mm_madd_epi16(ycr, coeff_r), 13);
+    __m128i g32 = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(ycb, coeff_g),
+					       _mm_madd_epi16(cr0, coeff_g2)),
+				 13);
+    __m128i b32 = _mm_srai_epi32(_mm_madd_epi16(ycb, coeff_b), 13);
+
+    // saturate to bytes: [R0-3 G0-3] and [B0-3 A0-3], then to 0..255
+    __m128i rg = _mm_packs_epi32(r32, g32);
+    __m128i ba = _mm_packs_epi32(b32, alpha);
+    __m128i rgba = _mm_packus_epi16(rg, ba);
+
+    _mm_storeu_si128((__m128i *) (dest + i),
+		     _mm_shuffle_epi8(rgba, interleave));
+  }
+
+  // tail
+  for (; i < count; i++) {
+    int32_t yy = y[i] << 13;
+    int32_t cb1 = cb[i] - 128;
+    int32_t cr1 = cr[i] - 128;
+
+    int32_t r = (yy + 11485 * cr1) >> 13;
+    int32_t g = (yy - 2819 * cb1 - 5850 * cr1) >> 13;
+    int32_t b = (yy + 14516 * cb1) >> 13;
+
+    r = CLAMP(r, 0, 255);
+    g = CLAMP(g, 0, 255);
+    b = CLAMP(b, 0, 255);
+
+    dest[i] = 0xFF000000 | (r << 16) | (g << 8) | b;
+  }
+}
+
+void _openslide_pixelops_rgb12_to_argb_ssse3(const uint16_t *src,
+					     uint32_t *dest, int64_t count) {
+  // x86 is little-endian, so the 16-bit samples can be used as loaded.
+  // scatter packed 8-bit RGB triplets into xRGB words, pixel p coming
+  // from bytes 3p..3p+2; -1 zeroes the unused high byte
+  const __m128i scatter = _mm_set_epi8(-1, 9, 10, 11,
+				       -1, 6, 7, 8,
+				       -1, 3, 4, 5,
+				       -1, 0, 1, 2);
+
+  int64_t i = 0;
+  // each iteration loads 16 samples (5 1/3 pixels) but converts 4, so
+  // stop while the overread still lands inside the buffer
+  for (; i + 6 <= count; i += 4) {
+    __m128i lo = _mm_loadu_si128((const __m128i *) (src + i * 3));
+    __m128i hi = _mm_loadu_si128((const __m128i *) (src + i * 3 + 8));
+
+    // scale down from 12 bits and narrow to bytes
+    __m128i packed = _mm_packus_epi16(_mm_srli_epi16(lo, 4),
+				      _mm_srli_epi16(hi, 4));
+
+    _mm_storeu_si128((__m128i *) (dest + i),
+		     _mm_shuffle_epi8(packed, scatter));
+  }
+
+  // tail
+  for (; i < count; i++) {
+    uint8_t r = src[(i * 3)] >> 4;
+    uint8_t g = src[(i * 3) + 1] >> 4;
+    uint8_t b = src[(i * 3) + 2] >> 4;
+
+    dest[i] = (r << 16) | (g << 8) | b;
+  }
+}
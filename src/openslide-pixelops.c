@@ -0,0 +1,162 @@
+/*
+ *  OpenSlide, a library for reading whole slide image files
+ *
+ *  Copyright (c) 2007-2013 Carnegie Mellon University
+ *  All rights reserved.
+ *
+ *  OpenSlide is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, version 2.1.
+ *
+ *  OpenSlide is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with OpenSlide. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include "openslide-pixelops.h"
+
+#include <glib.h>
+
+#ifdef HAVE_SSSE3_INTRINSICS
+#include <cpuid.h>
+#endif
+
+typedef void (*swizzle_rgba_fn)(uint32_t *buf, int64_t count);
+
+static void swizzle_rgba_scalar(uint32_t *buf, int64_t count) {
+  uint32_t *p = buf;
+  uint32_t *end = buf + count;
+  while (p < end) {
+    uint32_t val = *p;
+    *p++ = (val & 0xFF00FF00)
+      | ((val << 16) & 0xFF0000)
+      | ((val >> 16) & 0xFF);
+  }
+}
+
+static swizzle_rgba_fn swizzle_rgba_impl = swizzle_rgba_scalar;
+
+typedef void (*ycbcr_to_argb_fn)(const int32_t *y, const int32_t *cb,
+				 const int32_t *cr,
+				 uint32_t *dest, int64_t count);
+
+// fixed-point JFIF YCbCr -> RGB, coefficients scaled by 2^13.
+// matches the SSSE3 kernel bit for bit
+static void ycbcr_to_argb_scalar(const int32_t *y, const int32_t *cb,
+				 const int32_t *cr,
+				 uint32_t *dest, int64_t count) {
+  for (int64_t i = 0; i < count; i++) {
+    int32_t yy = y[i] << 13;
+    int32_t cb1 = cb[i] - 128;
+    int32_t cr1 = cr[i] - 128;
+
+    int32_t r = (yy + 11485 * cr1) >> 13;
+    int32_t g = (yy - 2819 * cb1 - 5850 * cr1) >> 13;
+    int32_t b = (yy + 14516 * cb1) >> 13;
+
+    r = CLAMP(r, 0, 255);
+    g = CLAMP(g, 0, 255);
+    b = CLAMP(b, 0, 255);
+
+    dest[i] = 0xFF000000 | (r << 16) | (g << 8) | b;
+  }
+}
+
+static ycbcr_to_argb_fn ycbcr_to_argb_impl = ycbcr_to_argb_scalar;
+
+typedef void (*rgb12_to_argb_fn)(const uint16_t *src,
+				 uint32_t *dest, int64_t count);
+
+static void rgb12_to_argb_scalar(const uint16_t *src,
+				 uint32_t *dest, int64_t count) {
+  for (int64_t i = 0; i < count; i++) {
+    // scale down from 12 bits
+    uint8_t r = GINT16_FROM_LE(src[(i * 3)]) >> 4;
+    uint8_t g = GINT16_FROM_LE(src[(i * 3) + 1]) >> 4;
+    uint8_t b = GINT16_FROM_LE(src[(i * 3) + 2]) >> 4;
+
+    dest[i] = (r << 16) | (g << 8) | b;
+  }
+}
+
+static rgb12_to_argb_fn rgb12_to_argb_impl = rgb12_to_argb_scalar;
+
+static gpointer init_pixelops(gpointer data G_GNUC_UNUSED) {
+#ifdef HAVE_SSSE3_INTRINSICS
+  unsigned int eax, ebx, ecx, edx;
+  if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_SSSE3)) {
+    swizzle_rgba_impl = _openslide_pixelops_swizzle_rgba_ssse3;
+    ycbcr_to_argb_impl = _openslide_pixelops_ycbcr_to_argb_ssse3;
+    rgb12_to_argb_impl = _openslide_pixelops_rgb12_to_argb_ssse3;
+  }
+#endif
+  return NULL;
+}
+
+static void ensure_pixelops(void) {
+  static GOnce pixelops_once = G_ONCE_INIT;
+  g_once(&pixelops_once, init_pixelops, NULL);
+}
+
+void _openslide_pixelops_swizzle_rgba(uint32_t *buf, int64_t count) {
+  ensure_pixelops();
+  swizzle_rgba_impl(buf, count);
+}
+
+void _openslide_pixelops_ycbcr_to_argb(const int32_t *y, const int32_t *cb,
+				       const int32_t *cr,
+				       uint32_t *dest, int64_t count) {
+  ensure_pixelops();
+  ycbcr_to_argb_impl(y, cb, cr, dest, count);
+}
+
+void _openslide_pixelops_rgb12_to_argb(const uint16_t *src,
+				       uint32_t *dest, int64_t count) {
+  ensure_pixelops();
+  rgb12_to_argb_impl(src, dest, count);
+}
+
+// box filter; averages the source rectangle under each destination pixel.
+// handles arbitrary (including fractional and identity) ratios
+void _openslide_pixelops_scale_argb(const uint32_t *src,
+				    int64_t src_w, int64_t src_h,
+				    uint32_t *dest,
+				    int64_t dest_w, int64_t dest_h) {
+  for (int64_t y = 0; y < dest_h; y++) {
+    int64_t sy0 = y * src_h / dest_h;
+    int64_t sy1 = MAX((y + 1) * src_h / dest_h, sy0 + 1);
+
+    for (int64_t x = 0; x < dest_w; x++) {
+      int64_t sx0 = x * src_w / dest_w;
+      int64_t sx1 = MAX((x + 1) * src_w / dest_w, sx0 + 1);
+
+      uint64_t a = 0;
+      uint64_t r = 0;
+      uint64_t g = 0;
+      uint64_t b = 0;
+      for (int64_t sy = sy0; sy < sy1; sy++) {
+	for (int64_t sx = sx0; sx < sx1; sx++) {
+	  uint32_t val = src[sy * src_w + sx];
+	  a += (val >> 24) & 0xFF;
+	  r += (val >> 16) & 0xFF;
+	  g += (val >> 8) & 0xFF;
+	  b += val & 0xFF;
+	}
+      }
+
+      uint64_t count = (sy1 - sy0) * (sx1 - sx0);
+      dest[y * dest_w + x] = ((a / count) << 24) |
+	((r / count) << 16) |
+	((g / count) << 8) |
+	(b / count);
+    }
+  }
+}
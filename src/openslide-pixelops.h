@@ -0,0 +1,67 @@
+/*
+ *  OpenSlide, a library for reading whole slide image files
+ *
+ *  Copyright (c) 2007-2013 Carnegie Mellon University
+ *  All rights reserved.
+ *
+ *  OpenSlide is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, version 2.1.
+ *
+ *  OpenSlide is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with OpenSlide. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef OPENSLIDE_OPENSLIDE_PIXELOPS_H_
+#define OPENSLIDE_OPENSLIDE_PIXELOPS_H_
+
+#include <config.h>
+
+#include <stdint.h>
+
+/*
+ * Bulk pixel conversion kernels for the tile decode hot paths.  Each
+ * operation has a portable scalar implementation and, where the build
+ * and the CPU allow, a vectorized one selected at runtime on first use.
+ */
+
+// convert libtiff RGBA output (R,G,B,A byte order) to cairo's
+// native-endian ARGB words, in place
+void _openslide_pixelops_swizzle_rgba(uint32_t *buf, int64_t count);
+
+// scale an ARGB image to the destination size with a box/area filter
+void _openslide_pixelops_scale_argb(const uint32_t *src,
+				    int64_t src_w, int64_t src_h,
+				    uint32_t *dest,
+				    int64_t dest_w, int64_t dest_h);
+
+// convert JFIF YCbCr samples to opaque cairo ARGB.  one sample per
+// pixel from each plane; subsampled chroma must be expanded first
+void _openslide_pixelops_ycbcr_to_argb(const int32_t *y, const int32_t *cb,
+				       const int32_t *cr,
+				       uint32_t *dest, int64_t count);
+
+// convert 12-bit little-endian RGB triplets (one sample per 16-bit
+// word, as in Hamamatsu NGR) to cairo xRGB, dropping the low 4 bits
+void _openslide_pixelops_rgb12_to_argb(const uint16_t *src,
+				       uint32_t *dest, int64_t count);
+
+#ifdef HAVE_SSSE3_INTRINSICS
+// in openslide-pixelops-ssse3.c, compiled with -mssse3
+void _openslide_pixelops_swizzle_rgba_ssse3(uint32_t *buf, int64_t count);
+void _openslide_pixelops_ycbcr_to_argb_ssse3(const int32_t *y,
+					     const int32_t *cb,
+					     const int32_t *cr,
+					     uint32_t *dest, int64_t count);
+void _openslide_pixelops_rgb12_to_argb_ssse3(const uint16_t *src,
+					     uint32_t *dest, int64_t count);
+#endif
+
+#endif
@@ -56,7 +56,21 @@ struct _openslide_associated_image {
   // must fail if width or height doesn't match the image
   void (*get_argb_data)(openslide_t *osr, void *ctx, uint32_t *dest,
                         int64_t w, int64_t h);
+
+  // optional; decode at a reduced size if the codec supports it.
+  // w and h are the full dimensions, as above.  The backend picks the
+  // smallest supported scale no smaller than (target_w, target_h) and
+  // returns the decoded dimensions; dest must be able to hold the
+  // full-size image.
+  void (*get_argb_data_scaled)(openslide_t *osr, void *ctx, uint32_t *dest,
+                               int64_t w, int64_t h,
+                               int64_t target_w, int64_t target_h,
+                               int64_t *got_w, int64_t *got_h);
+
   void (*destroy_ctx)(void *ctx);
+
+  // full-size pixels, pinned by the first full decode
+  uint32_t *argb_data;
 };
 
 /* the main structure */
@@ -75,8 +89,34 @@ struct _openslide {
   GHashTable *properties; // created automatically
   const char **property_names; // filled in automatically from hashtable
 
-  // cache
+  // pending quickhash1; digest is computed on first property access
+  struct _openslide_hash *quickhash1;
+
+  // slide profile sidecar; all NULL/false unless enabled at open
+  char *profile_path;
+  char *slide_id;
+  bool profile_loaded;         // a valid profile was read at open
+  bool profile_had_quickhash1; // ...and it already recorded the digest
+
+  // cache; may be the process-wide shared cache
   struct _openslide_cache *cache;
+  bool cache_is_shared;
+
+  // background prefetch; pool and hashtable created on first hint
+  GMutex *prefetch_mutex;
+  GThreadPool *prefetch_pool;
+  GHashTable *prefetch_hints;  // prefetch id -> struct prefetch_hint
+  int next_prefetch_id;
+
+  // performance counters, updated on the tile hot paths through
+  // _openslide_stat_add(); each counter is individually atomic, but
+  // the set as a whole may be mutually inconsistent
+  struct {
+    int64_t cache_hits;
+    int64_t cache_misses;
+    int64_t tiles_decoded;
+    int64_t bytes_decoded;
+  } stats;
 
   // error handling, NULL if no error
   gpointer error; // must use g_atomic_pointer!
@@ -95,6 +135,17 @@ struct _openslide_ops {
 		       int64_t x, int64_t y,
 		       int32_t level,
 		       int32_t w, int32_t h);
+  // optional; satisfy a read directly into dest (stride in pixels),
+  // bypassing cairo.  Must either fill the region and return true, or
+  // return false without setting an error so that the caller falls
+  // back to paint_region.  Backends should only claim requests that
+  // map onto integer coordinates in the level; pixels outside the
+  // level may be left alone, since the caller has cleared dest.
+  bool (*read_region_raw)(openslide_t *osr, uint32_t *dest,
+			  int64_t stride,
+			  int64_t x, int64_t y,
+			  int32_t level,
+			  int64_t w, int64_t h);
   void (*destroy)(openslide_t *osr);
 };
 
@@ -156,9 +207,31 @@ gboolean _openslide_read_key_file(GKeyFile *key_file, const char *filename,
 /* fopen() wrapper which properly sets FD_CLOEXEC */
 FILE *_openslide_fopen(const char *path, const char *mode, GError **err);
 
+/* I/O provider support (openslide-io.c) */
+bool _openslide_io_provider_active(void);
+FILE *_openslide_io_fopen(const char *path, GError **err);
+
 /* Returns the size of the file */
 int64_t _openslide_fsize(const char *path, GError **err);
 
+/* Readahead hints; no-ops where posix_fadvise() is unavailable or the
+   stream has no descriptor.  RANDOM and SEQUENTIAL describe the whole
+   file; WILLNEED asks for the given byte range */
+enum _openslide_fadvice {
+  _OPENSLIDE_FADVICE_RANDOM,
+  _OPENSLIDE_FADVICE_SEQUENTIAL,
+  _OPENSLIDE_FADVICE_WILLNEED,
+};
+void _openslide_fadvise(FILE *f, int64_t offset, int64_t length,
+                        enum _openslide_fadvice advice);
+void _openslide_fadvise_fd(int fd, int64_t offset, int64_t length,
+                           enum _openslide_fadvice advice);
+
+/* Relaxed atomic performance counters; GLib at our minimum version has
+   no 64-bit atomics, so these wrap the GCC builtins */
+void _openslide_stat_add(int64_t *counter, int64_t delta);
+int64_t _openslide_stat_get(int64_t *counter);
+
 /* Serialize double to string */
 char *_openslide_format_double(double d);
 
@@ -300,6 +373,9 @@ struct _openslide_ngr {
   int32_t h;
 
   int32_t column_width;
+
+  // persistent descriptor for pread(); -1 if unavailable
+  int fd;
 };
 
 void _openslide_add_ngr_ops(openslide_t *osr,
@@ -333,18 +409,5 @@ void _openslide_set_error_from_gerror(openslide_t *osr, GError *err);
 #define _OPENSLIDE_PROPERTY_NAME_TEMPLATE_LEVEL_TILE_WIDTH "openslide.level[%d].tile-width"
 #define _OPENSLIDE_PROPERTY_NAME_TEMPLATE_LEVEL_TILE_HEIGHT "openslide.level[%d].tile-height"
 
-// deprecated prefetch stuff (maybe we'll undeprecate it someday),
-// still needs these declarations for ABI compat
-// TODO: remove if soname bump
-#undef openslide_give_prefetch_hint
-OPENSLIDE_PUBLIC()
-int openslide_give_prefetch_hint(openslide_t *osr,
-				 int64_t x, int64_t y,
-				 int32_t level,
-				 int64_t w, int64_t h);
-#undef openslide_cancel_prefetch_hint
-OPENSLIDE_PUBLIC()
-void openslide_cancel_prefetch_hint(openslide_t *osr, int prefetch_id);
-
 
 #endif
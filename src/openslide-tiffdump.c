@@ -74,6 +74,28 @@ static int64_t read_uint32(FILE *f, uint16_t endian) {
   }
 }
 
+static uint16_t table_uint16(const uint8_t *buf, uint16_t endian) {
+  uint16_t result;
+  memcpy(&result, buf, sizeof result);
+
+  if (endian == TIFF_BIGENDIAN) {
+    return GUINT16_FROM_BE(result);
+  } else {
+    return GUINT16_FROM_LE(result);
+  }
+}
+
+static uint32_t table_uint32(const uint8_t *buf, uint16_t endian) {
+  uint32_t result;
+  memcpy(&result, buf, sizeof result);
+
+  if (endian == TIFF_BIGENDIAN) {
+    return GUINT32_FROM_BE(result);
+  } else {
+    return GUINT32_FROM_LE(result);
+  }
+}
+
 static bool read_tiff_tag(FILE *f, int64_t size, void *dest,
 			  int64_t offset, uint8_t value[]) {
   //  g_debug(" reading tiff tag: size: %d, value/offset %u", (int) size, (int) offset);
@@ -246,6 +268,89 @@ static void *read_tiff_tag_8(FILE *f,
   return NULL;
 }
 
+// bytes occupied by one value of the given type, or -1 if unknown
+static int64_t value_size(TIFFDataType type) {
+  switch (type) {
+  case TIFF_BYTE:
+  case TIFF_ASCII:
+  case TIFF_SBYTE:
+  case TIFF_UNDEFINED:
+    return 1;
+
+  case TIFF_SHORT:
+  case TIFF_SSHORT:
+    return 2;
+
+  case TIFF_LONG:
+  case TIFF_SLONG:
+  case TIFF_FLOAT:
+  case TIFF_IFD:
+    return 4;
+
+  case TIFF_RATIONAL:
+  case TIFF_SRATIONAL:
+  case TIFF_DOUBLE:
+    return 8;
+
+  default:
+    return -1;
+  }
+}
+
+// read the value on first use.  the entry header was validated when the
+// directory was parsed, so a failure here is a real I/O error; substitute
+// zeros rather than making every accessor fallible
+static void *fetch_value(struct _openslide_tiffdump_item *item) {
+  if (item->value != NULL) {
+    return item->value;
+  }
+
+  switch (item->type) {
+  case TIFF_BYTE:
+  case TIFF_ASCII:
+  case TIFF_SBYTE:
+  case TIFF_UNDEFINED:
+    item->value = read_tiff_tag_1(item->f, item->count, item->offset,
+				  item->inline_value);
+    break;
+
+  case TIFF_SHORT:
+  case TIFF_SSHORT:
+    item->value = read_tiff_tag_2(item->f, item->count, item->offset,
+				  item->inline_value, item->endian);
+    break;
+
+  case TIFF_LONG:
+  case TIFF_SLONG:
+  case TIFF_FLOAT:
+  case TIFF_IFD:
+    item->value = read_tiff_tag_4(item->f, item->count, item->offset,
+				  item->inline_value, item->endian);
+    break;
+
+  case TIFF_RATIONAL:
+  case TIFF_SRATIONAL:
+    item->value = read_tiff_tag_4(item->f, item->count * 2, item->offset,
+				  item->inline_value, item->endian);
+    break;
+
+  case TIFF_DOUBLE:
+    item->value = read_tiff_tag_8(item->f, item->count, item->offset,
+				  item->endian);
+    break;
+
+  default:
+    g_assert_not_reached();
+  }
+
+  if (item->value == NULL) {
+    g_warning("Cannot read TIFF tag value at %" G_GINT64_FORMAT, item->offset);
+    item->value = g_malloc0(value_size(item->type) * item->count);
+  }
+
+  return item->value;
+}
+
 static void tiffdump_item_destroy(gpointer data) {
   struct _openslide_tiffdump_item *td = data;
 
@@ -256,12 +361,13 @@ static void tiffdump_item_destroy(gpointer data) {
 static GHashTable *read_directory(FILE *f, int64_t *diroff,
 				  GHashTable *loop_detector,
 				  uint16_t endian,
+				  int64_t file_size,
 				  GError **err) {
   int64_t off = *diroff;
   *diroff = 0;
   GHashTable *result = NULL;
   int64_t *key = NULL;
-  int64_t nextdiroff = -1;
+  uint8_t *table = NULL;
   int dircount = -1;
 
   //  g_debug("diroff: %" PRId64, off);
@@ -299,88 +405,53 @@ static GHashTable *read_directory(FILE *f, int64_t *diroff,
 
   //  g_debug("dircount: %d", dircount);
 
+  // read the entire entry table, plus the next directory offset,
+  // in one read
+  const int64_t table_size = 12 * (int64_t) dircount + 4;
+  table = g_try_malloc(table_size);
+  if (table == NULL || fread(table, table_size, 1, f) != 1) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_BAD_DATA,
+                "Cannot read directory entries");
+    goto FAIL;
+  }
 
   // initial checks passed, initialized the hashtable
   result = g_hash_table_new_full(g_int_hash, g_int_equal,
 				 g_free, tiffdump_item_destroy);
 
-  // read all directory entries
+  // record all directory entries; values are fetched on demand
   for (int i = 0; i < dircount; i++) {
-    int32_t tag = read_uint16(f, endian);
-    int32_t type = read_uint16(f, endian);
-    int64_t count = read_uint32(f, endian);
-
-    if ((tag == -1) || (type == -1) || (count == -1)) {
-      g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_BAD_DATA,
-                  "Cannot read tag, type, and count");
-      goto FAIL;
-    }
+    const uint8_t *entry = table + 12 * i;
+    int32_t tag = table_uint16(entry, endian);
+    int32_t type = table_uint16(entry + 2, endian);
+    int64_t count = table_uint32(entry + 4, endian);
+    int64_t offset = table_uint32(entry + 8, endian);
 
     //    g_debug(" tag: %d, type: %d, count: %" PRId64, tag, type, count);
 
-    // read in the value/offset
-    uint8_t value[4];
-    if (fread(value, 1, 4, f) != 4) {
+    const int64_t esize = value_size((TIFFDataType) type);
+    if (esize == -1) {
       g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_BAD_DATA,
-                  "Cannot read value/offset");
+                  "Unknown type encountered: %d", type);
       goto FAIL;
     }
 
-    uint32_t offset;
-    memcpy(&offset, value, 4);
-    if (endian == TIFF_BIGENDIAN) {
-      offset = GUINT32_FROM_BE(offset);
-    } else {
-      offset = GUINT32_FROM_LE(offset);
+    // out-of-line values must lie within the file
+    if (esize * count > 4 && offset + esize * count > file_size) {
+      g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_BAD_DATA,
+                  "Tag value out of range");
+      goto FAIL;
     }
 
     // allocate the item
     struct _openslide_tiffdump_item *data =
-      g_slice_new(struct _openslide_tiffdump_item);
+      g_slice_new0(struct _openslide_tiffdump_item);
     data->type = (TIFFDataType) type;
     data->count = count;
-
-    // load the value
-    switch (type) {
-    case TIFF_BYTE:
-    case TIFF_ASCII:
-    case TIFF_SBYTE:
-    case TIFF_UNDEFINED:
-      data->value = read_tiff_tag_1(f, count, offset, value);
-      break;
-
-    case TIFF_SHORT:
-    case TIFF_SSHORT:
-      data->value = read_tiff_tag_2(f, count, offset, value, endian);
-      break;
-
-    case TIFF_LONG:
-    case TIFF_SLONG:
-    case TIFF_FLOAT:
-    case TIFF_IFD:
-      data->value = read_tiff_tag_4(f, count, offset, value, endian);
-      break;
-
-    case TIFF_RATIONAL:
-    case TIFF_SRATIONAL:
-      data->value = read_tiff_tag_4(f, count * 2, offset, value, endian);
-      break;
-
-    case TIFF_DOUBLE:
-      data->value = read_tiff_tag_8(f, count, offset, endian);
-      break;
-
-    default:
-      g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_BAD_DATA,
-                  "Unknown type encountered: %d", type);
-      goto FAIL;
-    }
-
-    if (data->value == NULL) {
-      g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_BAD_DATA,
-                  "Cannot read value");
-      goto FAIL;
-    }
+    data->f = f;
+    data->endian = endian;
+    data->offset = offset;
+    memcpy(data->inline_value, entry + 8, 4);
 
     // add this tag to the hashtable
     int *key = g_new(int, 1);
@@ -388,16 +459,11 @@ static GHashTable *read_directory(FILE *f, int64_t *diroff,
     g_hash_table_insert(result, key, data);
   }
 
-  // read the next dir offset
-  nextdiroff = read_uint32(f, endian);
-  if (nextdiroff == -1) {
-    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_BAD_DATA,
-                "Cannot read next directory offset");
-    goto FAIL;
-  }
-  *diroff = nextdiroff;
+  // the next dir offset follows the entry table
+  *diroff = table_uint32(table + 12 * dircount, endian);
 
   // success
+  g_free(table);
   return result;
 
 
@@ -405,11 +471,19 @@ static GHashTable *read_directory(FILE *f, int64_t *diroff,
   if (result != NULL) {
     g_hash_table_unref(result);
   }
+  g_free(table);
   return NULL;
 }
 
 // returns list of hashtables of (int -> struct _openslide_tiffdump_item)
 GSList *_openslide_tiffdump_create(FILE *f, GError **err) {
+  // get file size, for validating value offsets
+  if (fseeko(f, 0, SEEK_END) != 0) {
+    _openslide_io_error(err, "Cannot seek to end");
+    return NULL;
+  }
+  const int64_t file_size = ftello(f);
+
   // read and check magic
   uint16_t magic;
   fseeko(f, 0, SEEK_SET);
@@ -446,7 +520,8 @@ GSList *_openslide_tiffdump_create(FILE *f, GError **err) {
   GSList *result = NULL;
   while (diroff != 0) {
     // read a directory
-    GHashTable *ht = read_directory(f, &diroff, loop_detector, magic, err);
+    GHashTable *ht = read_directory(f, &diroff, loop_detector, magic,
+				    file_size, err);
 
     // was the directory successfully read?
     if (ht == NULL) {
@@ -608,24 +683,24 @@ static void check_assertions(struct _openslide_tiffdump_item *item,
 uint8_t _openslide_tiffdump_get_byte(struct _openslide_tiffdump_item *item,
 				     int64_t i) {
   check_assertions(item, TIFF_BYTE, i);
-  return ((uint8_t *) item->value)[i];
+  return ((uint8_t *) fetch_value(item))[i];
 }
 
 const char *_openslide_tiffdump_get_ascii(struct _openslide_tiffdump_item *item) {
   check_assertions(item, TIFF_ASCII, 0);
-  return item->value;
+  return fetch_value(item);
 }
 
 uint16_t _openslide_tiffdump_get_short(struct _openslide_tiffdump_item *item,
 				       int64_t i) {
   check_assertions(item, TIFF_SHORT, i);
-  return ((uint16_t *) item->value)[i];
+  return ((uint16_t *) fetch_value(item))[i];
 }
 
 uint32_t _openslide_tiffdump_get_long(struct _openslide_tiffdump_item *item,
 				      int64_t i) {
   check_assertions(item, TIFF_LONG, i);
-  return ((uint32_t *) item->value)[i];
+  return ((uint32_t *) fetch_value(item))[i];
 }
 
 double _openslide_tiffdump_get_rational(struct _openslide_tiffdump_item *item,
@@ -633,32 +708,32 @@ double _openslide_tiffdump_get_rational(struct _openslide_tiffdump_item *item,
   check_assertions(item, TIFF_RATIONAL, i);
 
   // convert 2 longs into rational
-  uint32_t *value = item->value;
+  uint32_t *value = fetch_value(item);
   return (double) value[i * 2] / (double) value[i * 2 + 1];
 }
 
 int8_t _openslide_tiffdump_get_sbyte(struct _openslide_tiffdump_item *item,
 				     int64_t i) {
   check_assertions(item, TIFF_SBYTE, i);
-  return ((uint8_t *) item->value)[i];
+  return ((uint8_t *) fetch_value(item))[i];
 }
 
 uint8_t _openslide_tiffdump_get_undefined(struct _openslide_tiffdump_item *item,
 					  int64_t i) {
   check_assertions(item, TIFF_UNDEFINED, i);
-  return ((uint8_t *) item->value)[i];
+  return ((uint8_t *) fetch_value(item))[i];
 }
 
 int16_t _openslide_tiffdump_get_sshort(struct _openslide_tiffdump_item *item,
 				       int64_t i) {
   check_assertions(item, TIFF_SSHORT, i);
-  return ((uint16_t *) item->value)[i];
+  return ((uint16_t *) fetch_value(item))[i];
 }
 
 int32_t _openslide_tiffdump_get_slong(struct _openslide_tiffdump_item *item,
 				      int64_t i) {
   check_assertions(item, TIFF_SLONG, i);
-  return ((uint32_t *) item->value)[i];
+  return ((uint32_t *) fetch_value(item))[i];
 }
 
 double _openslide_tiffdump_get_srational(struct _openslide_tiffdump_item *item,
@@ -666,7 +741,7 @@ double _openslide_tiffdump_get_srational(struct _openslide_tiffdump_item *item,
   check_assertions(item, TIFF_SRATIONAL, i);
 
   // convert 2 slongs into rational
-  uint32_t *value = item->value;
+  uint32_t *value = fetch_value(item);
   return (double) ((int32_t) value[i * 2]) /
     (double) ((int32_t) value[i * 2 + 1]);
 }
@@ -676,7 +751,7 @@ float _openslide_tiffdump_get_float(struct _openslide_tiffdump_item *item,
   check_assertions(item, TIFF_FLOAT, i);
 
   float val;
-  memcpy(&val, ((uint32_t *) item->value) + i, sizeof val);
+  memcpy(&val, ((uint32_t *) fetch_value(item)) + i, sizeof val);
   return val;
 }
 
@@ -685,12 +760,12 @@ double _openslide_tiffdump_get_double(struct _openslide_tiffdump_item *item,
   check_assertions(item, TIFF_DOUBLE, i);
 
   double val;
-  memcpy(&val, ((uint64_t *) item->value) + i, sizeof val);
+  memcpy(&val, ((uint64_t *) fetch_value(item)) + i, sizeof val);
   return val;
 }
 
 int64_t _openslide_tiffdump_get_ifd(struct _openslide_tiffdump_item *item,
 				    int64_t i) {
   check_assertions(item, TIFF_IFD, i);
-  return ((uint32_t *) item->value)[i];
+  return ((uint32_t *) fetch_value(item))[i];
 }
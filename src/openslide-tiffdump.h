@@ -30,10 +30,18 @@
 struct _openslide_tiffdump_item {
   TIFFDataType type;
   int64_t count;
-  void *value;
+  void *value;   // NULL until fetched; use the accessors below
+
+  // private; used to fetch the value on demand
+  FILE *f;
+  uint16_t endian;
+  int64_t offset;
+  uint8_t inline_value[4];
 };
 
 // returns list of hashtables of (int -> struct _openslide_tiffdump)
+// values are read lazily on first access, so f must remain open until
+// the tiffdump is destroyed
 GSList *_openslide_tiffdump_create(FILE *f, GError **err);
 
 // destructor
@@ -25,10 +25,161 @@
 #include "openslide-tilehelper.h"
 
 #include <glib.h>
+#include <stdlib.h>
 #include <string.h>
 #include <math.h>
 #include <cairo.h>
 
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+/*
+ * Parallel decode support.  Compositing into the cairo context must
+ * remain ordered, but decoding cache-missing tiles is embarrassingly
+ * parallel: we first warm the cache by invoking read_tile with a NULL
+ * cairo context from a worker pool, then run the ordinary serial
+ * compositing loop, which now hits the cache for every tile.
+ *
+ * Backends opt in via the concurrent parameter, which asserts that
+ * read_tile may be called from multiple threads with the given arg.
+ */
+
+struct decode_batch {
+  openslide_t *osr;
+  int32_t level;
+  struct _openslide_cache *cache;
+  void *arg;
+  void (*read_tile)(openslide_t *osr,
+                    cairo_t *cr,
+                    int32_t level,
+                    int64_t tile_x, int64_t tile_y,
+                    double translate_x, double translate_y,
+                    struct _openslide_cache *cache,
+                    void *arg);
+
+  GMutex *mutex;
+  GCond *cond;
+  int remaining;
+};
+
+struct decode_task {
+  struct decode_batch *batch;
+  int64_t tile_x;
+  int64_t tile_y;
+};
+
+static GThreadPool *decode_pool;
+static int decode_pool_threads;
+
+static int compute_decode_threads(void) {
+  // allow override for benchmarking and for decode-bound servers that
+  // do their own parallelism
+  const char *env = g_getenv("OPENSLIDE_DECODE_THREADS");
+  if (env != NULL) {
+    int threads = atoi(env);
+    if (threads >= 1) {
+      return threads;
+    }
+  }
+
+#ifdef _SC_NPROCESSORS_ONLN
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  if (n > 1) {
+    return MIN(n, 32);
+  }
+#endif
+
+  return 1;
+}
+
+static void decode_task_func(gpointer task_data,
+                             gpointer user_data G_GNUC_UNUSED) {
+  struct decode_task *task = task_data;
+  struct decode_batch *batch = task->batch;
+
+  // NULL cairo context: decode into the cache, don't composite
+  batch->read_tile(batch->osr, NULL, batch->level,
+                   task->tile_x, task->tile_y,
+                   0, 0,
+                   batch->cache, batch->arg);
+
+  g_slice_free(struct decode_task, task);
+
+  g_mutex_lock(batch->mutex);
+  if (!--batch->remaining) {
+    g_cond_signal(batch->cond);
+  }
+  g_mutex_unlock(batch->mutex);
+}
+
+static gpointer create_decode_pool(gpointer data G_GNUC_UNUSED) {
+  decode_pool_threads = compute_decode_threads();
+  if (decode_pool_threads > 1) {
+    decode_pool = g_thread_pool_new(decode_task_func, NULL,
+                                    decode_pool_threads, FALSE, NULL);
+  }
+  return NULL;
+}
+
+static void warm_tiles(int32_t level,
+                       int64_t start_tile_x, int64_t start_tile_y,
+                       int64_t end_tile_x, int64_t end_tile_y,
+                       openslide_t *osr,
+                       struct _openslide_cache *cache,
+                       void *arg,
+                       void (*read_tile)(openslide_t *osr,
+                                         cairo_t *cr,
+                                         int32_t level,
+                                         int64_t tile_x, int64_t tile_y,
+                                         double translate_x,
+                                         double translate_y,
+                                         struct _openslide_cache *cache,
+                                         void *arg)) {
+  static GOnce decode_pool_once = G_ONCE_INIT;
+  g_once(&decode_pool_once, create_decode_pool, NULL);
+  if (decode_pool == NULL) {
+    // single-core machine, or pool creation failed
+    return;
+  }
+
+  struct decode_batch batch = {
+    .osr = osr,
+    .level = level,
+    .cache = cache,
+    .arg = arg,
+    .read_tile = read_tile,
+    .mutex = g_mutex_new(),
+    .cond = g_cond_new(),
+    .remaining = 0,
+  };
+
+  for (int64_t tile_y = start_tile_y; tile_y < end_tile_y; tile_y++) {
+    for (int64_t tile_x = start_tile_x; tile_x < end_tile_x; tile_x++) {
+      struct decode_task *task = g_slice_new(struct decode_task);
+      task->batch = &batch;
+      task->tile_x = tile_x;
+      task->tile_y = tile_y;
+
+      g_mutex_lock(batch.mutex);
+      batch.remaining++;
+      g_mutex_unlock(batch.mutex);
+
+      g_thread_pool_push(decode_pool, task, NULL);
+    }
+  }
+
+  // wait for the batch to drain
+  g_mutex_lock(batch.mutex);
+  while (batch.remaining) {
+    g_cond_wait(batch.cond, batch.mutex);
+  }
+  g_mutex_unlock(batch.mutex);
+
+  g_cond_free(batch.cond);
+  g_mutex_free(batch.mutex);
+}
+
 void _openslide_read_tiles(cairo_t *cr,
 			   int32_t level,
 			   int64_t start_tile_x, int64_t start_tile_y,
@@ -37,6 +188,7 @@ void _openslide_read_tiles(cairo_t *cr,
 			   double advance_x, double advance_y,
 			   openslide_t *osr,
 			   struct _openslide_cache *cache,
+			   bool concurrent,
 			   void *arg,
 			   void (*read_tile)(openslide_t *osr,
 					     cairo_t *cr,
@@ -62,6 +214,18 @@ void _openslide_read_tiles(cairo_t *cr,
   //g_debug("start: %" G_GINT64_FORMAT " %" G_GINT64_FORMAT, start_tile_x, start_tile_y);
   //g_debug("end: %" G_GINT64_FORMAT " %" G_GINT64_FORMAT, end_tile_x, end_tile_y);
 
+  // decode cache misses concurrently before the ordered compositing pass
+  if (concurrent &&
+      (end_tile_x - start_tile_x) * (end_tile_y - start_tile_y) > 1) {
+    warm_tiles(level,
+               start_tile_x, start_tile_y,
+               end_tile_x, end_tile_y,
+               osr, cache, arg, read_tile);
+    if (openslide_get_error(osr)) {
+      return;
+    }
+  }
+
   int64_t tile_y = end_tile_y - 1;
 
   while (tile_y >= start_tile_y) {
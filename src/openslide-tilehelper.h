@@ -31,6 +31,10 @@
 #include <stdint.h>
 #include <cairo.h>
 
+// If concurrent is true, read_tile must be safe to call from multiple
+// threads with the given arg; cache misses are then decoded on a worker
+// pool before the serial compositing pass.  read_tile must treat a NULL
+// cairo context as "decode into the cache only, don't composite".
 void _openslide_read_tiles(cairo_t *cr,
 			   int32_t level,
 			   int64_t start_tile_x, int64_t start_tile_y,
@@ -39,6 +43,7 @@ void _openslide_read_tiles(cairo_t *cr,
 			   double advance_x, double advance_y,
 			   openslide_t *osr,
 			   struct _openslide_cache *cache,
+			   bool concurrent,
 			   void *arg,
 			   void (*read_tile)(openslide_t *osr,
 					     cairo_t *cr,
@@ -27,7 +27,7 @@
 #include <string.h>
 #include <glib.h>
 
-#ifdef HAVE_FCNTL
+#if defined HAVE_FCNTL || defined HAVE_POSIX_FADVISE
 #include <unistd.h>
 #include <fcntl.h>
 #endif
@@ -116,6 +116,17 @@ gboolean _openslide_read_key_file(GKeyFile *key_file, const char *filename,
 
 FILE *_openslide_fopen(const char *path, const char *mode, GError **err)
 {
+  // a registered I/O provider intercepts all reads; it has no
+  // write support, so "wb" callers (all best-effort) fail cleanly
+  if (_openslide_io_provider_active()) {
+    if (strcmp(mode, "rb")) {
+      _openslide_io_error(err, "I/O provider is read-only; couldn't open %s",
+			  path);
+      return NULL;
+    }
+    return _openslide_io_fopen(path, err);
+  }
+
   char *m = g_strconcat(mode, FOPEN_CLOEXEC_FLAG, NULL);
   FILE *f = fopen(path, m);
   g_free(m);
@@ -149,6 +160,58 @@ FILE *_openslide_fopen(const char *path, const char *mode, GError **err)
   return f;
 }
 
+#ifdef HAVE_POSIX_FADVISE
+void _openslide_fadvise_fd(int fd, int64_t offset, int64_t length,
+                           enum _openslide_fadvice advice) {
+  if (fd == -1) {
+    return;
+  }
+
+  int adv;
+  switch (advice) {
+  case _OPENSLIDE_FADVICE_RANDOM:
+    adv = POSIX_FADV_RANDOM;
+    break;
+  case _OPENSLIDE_FADVICE_SEQUENTIAL:
+    adv = POSIX_FADV_SEQUENTIAL;
+    break;
+  case _OPENSLIDE_FADVICE_WILLNEED:
+    adv = POSIX_FADV_WILLNEED;
+    break;
+  default:
+    g_assert_not_reached();
+  }
+
+  // purely advisory; ignore failures
+  posix_fadvise(fd, offset, length, adv);
+}
+
+void _openslide_fadvise(FILE *f, int64_t offset, int64_t length,
+                        enum _openslide_fadvice advice) {
+  // I/O provider streams have no descriptor; they do their own caching
+  _openslide_fadvise_fd(fileno(f), offset, length, advice);
+}
+#else
+void _openslide_fadvise_fd(int fd G_GNUC_UNUSED,
+                           int64_t offset G_GNUC_UNUSED,
+                           int64_t length G_GNUC_UNUSED,
+                           enum _openslide_fadvice advice G_GNUC_UNUSED) {}
+
+void _openslide_fadvise(FILE *f G_GNUC_UNUSED,
+                        int64_t offset G_GNUC_UNUSED,
+                        int64_t length G_GNUC_UNUSED,
+                        enum _openslide_fadvice advice G_GNUC_UNUSED) {}
+#endif
+
+void _openslide_stat_add(int64_t *counter, int64_t delta) {
+  __sync_fetch_and_add(counter, delta);
+}
+
+int64_t _openslide_stat_get(int64_t *counter) {
+  // atomic read, so 32-bit targets can't see a torn value
+  return __sync_fetch_and_add(counter, 0);
+}
+
 int64_t _openslide_fsize(const char *path, GError **err) {
   FILE *f = _openslide_fopen(path, "rb", err);
   if (f == NULL) {
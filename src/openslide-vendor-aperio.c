@@ -31,6 +31,7 @@
 #include <config.h>
 
 #include "openslide-private.h"
+#include "openslide-pixelops.h"
 
 #include <glib.h>
 #include <string.h>
@@ -44,34 +45,6 @@ static const char APERIO_DESCRIPTION[] = "Aperio";
 #define APERIO_COMPRESSION_JP2K_YCBCR 33003
 #define APERIO_COMPRESSION_JP2K_RGB   33005
 
-// TODO: replace with tables
-static void write_pixel_ycbcr(uint32_t *dest, uint8_t c0, uint8_t c1, uint8_t c2) {
-  double R = c0 + 1.402 * (c2 - 128);
-  double G = c0 - 0.34414 * (c1 - 128) - 0.71414 * (c2 - 128);
-  double B = c0 + 1.772 * (c1 - 128);
-
-  if (R > 255) {
-    R = 255;
-  }
-  if (R < 0) {
-    R = 0;
-  }
-  if (G > 255) {
-    G = 255;
-  }
-  if (G < 0) {
-    G = 0;
-  }
-  if (B > 255) {
-    B = 255;
-  }
-  if (B < 0) {
-    B = 0;
-  }
-
-  *dest = 255 << 24 | ((uint8_t) R << 16) | ((uint8_t) G << 8) | ((uint8_t) B);
-}
-
 static void write_pixel_rgb(uint32_t *dest, uint8_t c0, uint8_t c1, uint8_t c2) {
   *dest = 255 << 24 | c0 << 16 | c1 << 8 | c2;
 }
@@ -85,6 +58,18 @@ static void error_callback(const char *msg, void *data) {
   _openslide_set_error(osr, "OpenJPEG error: %s", msg);
 }
 
+// expand a subsampled component row to one sample per pixel
+static const int32_t *expand_row(const int32_t *src, int sub_x,
+				 int32_t *scratch, int32_t w) {
+  if (sub_x == 1) {
+    return src;
+  }
+  for (int32_t x = 0; x < w; x++) {
+    scratch[x] = src[x / sub_x];
+  }
+  return scratch;
+}
+
 static void copy_aperio_tile(uint16_t compression_mode,
 			     opj_image_comp_t *comps,
 			     uint32_t *dest,
@@ -92,24 +77,35 @@ static void copy_aperio_tile(uint16_t compression_mode,
 			     int c0_sub_x, int c0_sub_y,
 			     int c1_sub_x, int c1_sub_y,
 			     int c2_sub_x, int c2_sub_y) {
-  // TODO: too slow, and with duplicated code!
-
   int i = 0;
 
   switch (compression_mode) {
-  case APERIO_COMPRESSION_JP2K_YCBCR:
-    for (int y = 0; y < h; y++) {
-      for (int x = 0; x < w; x++) {
-	uint8_t c0 = comps[0].data[(y / c0_sub_y) * comps[0].w + (x / c0_sub_x)];
-	uint8_t c1 = comps[1].data[(y / c1_sub_y) * comps[1].w + (x / c1_sub_x)];
-	uint8_t c2 = comps[2].data[(y / c2_sub_y) * comps[2].w + (x / c2_sub_x)];
+  case APERIO_COMPRESSION_JP2K_YCBCR: {
+    // the conversion kernel wants one sample per pixel from each
+    // plane, so expand subsampled rows before converting
+    int32_t *scratch = NULL;
+    if (c0_sub_x != 1 || c1_sub_x != 1 || c2_sub_x != 1) {
+      scratch = g_new(int32_t, 3 * w);
+    }
 
-	write_pixel_ycbcr(dest + i, c0, c1, c2);
-	i++;
-      }
+    for (int y = 0; y < h; y++) {
+      const int32_t *c0 = expand_row(comps[0].data +
+				     (int64_t) (y / c0_sub_y) * comps[0].w,
+				     c0_sub_x, scratch, w);
+      const int32_t *c1 = expand_row(comps[1].data +
+				     (int64_t) (y / c1_sub_y) * comps[1].w,
+				     c1_sub_x, scratch + w, w);
+      const int32_t *c2 = expand_row(comps[2].data +
+				     (int64_t) (y / c2_sub_y) * comps[2].w,
+				     c2_sub_x, scratch + 2 * w, w);
+
+      _openslide_pixelops_ycbcr_to_argb(c0, c1, c2,
+					dest + (int64_t) y * w, w);
     }
 
+    g_free(scratch);
     break;
+  }
 
   case APERIO_COMPRESSION_JP2K_RGB:
     for (int y = 0; y < h; y++) {
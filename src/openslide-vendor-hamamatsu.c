@@ -483,6 +483,7 @@ static bool hamamatsu_vmu_part2(openslide_t *osr,
 					 num_files);
   for (int i = 0; i < num_files; i++) {
     files[i] = g_slice_new0(struct _openslide_ngr);
+    files[i]->fd = -1;
   }
 
   // open files
@@ -421,246 +421,358 @@ static bool get_subtile_position(int32_t *tile_positions,
   }
 }
 
-static bool process_hier_data_pages_from_indexfile(FILE *f,
-						   int64_t seek_location,
-						   int datafile_count,
-						   char **datafile_names,
-						   const char *dirname,
-						   int zoom_levels,
-						   struct _openslide_jpeg_level **levels,
-						   int tiles_across,
-						   int tiles_down,
-						   int image_divisions,
-						   const struct slide_zoom_level_params *slide_zoom_level_params,
-						   int32_t *tile_positions,
-						   GList **jpegs_list,
-						   struct _openslide_hash *quickhash1,
-						   GError **err) {
+// everything one zoom level's parse needs; the shared inputs are
+// read-only while the parse threads are running
+struct zoom_level_parse {
+  const char *index_path;
+  int64_t seek_location;
+  int datafile_count;
+  char **datafile_names;
+  const char *dirname;
+  int zoom_levels;
+  struct _openslide_jpeg_level **levels;
+  int tiles_across;
+  int tiles_down;
+  int image_divisions;
+  const struct slide_zoom_level_params *slide_zoom_level_params;
+  int32_t *tile_positions;
+  GHashTable *active_positions;
+  struct _openslide_hash *quickhash1;
+
+  int zoom_level;
+
+  // outputs
+  GList *jpegs_list;  // reversed
+  int32_t jpeg_count;
+  GError *err;
+};
+
+static void process_one_zoom_level(FILE *f, struct zoom_level_parse *zp) {
+  const int zoom_level = zp->zoom_level;
+  struct _openslide_jpeg_level *l = zp->levels[zoom_level];
+  const struct slide_zoom_level_params *lp = zp->slide_zoom_level_params +
+      zoom_level;
+  GError **err = &zp->err;
   int32_t jpeg_number = 0;
+  int32_t ptr;
 
-  bool success = false;
+  //    g_debug("reading zoom_level %d", zoom_level);
 
-  // used for storing which positions actually have data
-  GHashTable *active_positions = g_hash_table_new_full(g_int_hash, g_int_equal,
-						       g_free, NULL);
+  if (fseeko(f, zp->seek_location, SEEK_SET) == -1) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_BAD_DATA,
+                "Cannot seek to zoom level pointer %d", zoom_level);
+    return;
+  }
 
-  for (int zoom_level = 0; zoom_level < zoom_levels; zoom_level++) {
-    struct _openslide_jpeg_level *l = levels[zoom_level];
-    const struct slide_zoom_level_params *lp = slide_zoom_level_params +
-        zoom_level;
-    int32_t ptr;
+  ptr = read_le_int32_from_file(f);
+  if (ptr == -1) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_BAD_DATA,
+                "Can't read zoom level pointer");
+    return;
+  }
+  if (fseeko(f, ptr, SEEK_SET) == -1) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_BAD_DATA,
+                "Cannot seek to start of data pages");
+    return;
+  }
 
-    //    g_debug("reading zoom_level %d", zoom_level);
+  // read initial 0
+  if (read_le_int32_from_file(f) != 0) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_BAD_DATA,
+                "Expected 0 value at beginning of data page");
+    return;
+  }
 
-    if (fseeko(f, seek_location, SEEK_SET) == -1) {
-      g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_BAD_DATA,
-                  "Cannot seek to zoom level pointer %d", zoom_level);
-      goto DONE;
-    }
+  // read pointer
+  ptr = read_le_int32_from_file(f);
+  if (ptr == -1) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_BAD_DATA,
+                "Can't read initial data page pointer");
+    return;
+  }
 
-    ptr = read_le_int32_from_file(f);
-    if (ptr == -1) {
-      g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_BAD_DATA,
-                  "Can't read zoom level pointer");
-      goto DONE;
-    }
-    if (fseeko(f, ptr, SEEK_SET) == -1) {
-      g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_BAD_DATA,
-                  "Cannot seek to start of data pages");
-      goto DONE;
-    }
+  // seek to offset
+  if (fseeko(f, ptr, SEEK_SET) == -1) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_BAD_DATA,
+                "Can't seek to initial data page");
+    return;
+  }
 
-    // read initial 0
-    if (read_le_int32_from_file(f) != 0) {
+  int32_t next_ptr;
+  do {
+    // read length
+    int32_t page_len = read_le_int32_from_file(f);
+    if (page_len == -1) {
       g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_BAD_DATA,
-                  "Expected 0 value at beginning of data page");
-      goto DONE;
+                  "Can't read page length");
+      return;
     }
 
-    // read pointer
-    ptr = read_le_int32_from_file(f);
-    if (ptr == -1) {
-      g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_BAD_DATA,
-                  "Can't read initial data page pointer");
-      goto DONE;
-    }
+    //    g_debug("page_len: %d", page_len);
 
-    // seek to offset
-    if (fseeko(f, ptr, SEEK_SET) == -1) {
+    // read "next" pointer
+    next_ptr = read_le_int32_from_file(f);
+    if (next_ptr == -1) {
       g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_BAD_DATA,
-                  "Can't seek to initial data page");
-      goto DONE;
+                  "Cannot read \"next\" pointer");
+      return;
     }
 
-    int32_t next_ptr;
-    do {
-      // read length
-      int32_t page_len = read_le_int32_from_file(f);
-      if (page_len == -1) {
+    // read all the data into the list
+    for (int i = 0; i < page_len; i++) {
+      int32_t tile_index = read_le_int32_from_file(f);
+      int32_t offset = read_le_int32_from_file(f);
+      int32_t length = read_le_int32_from_file(f);
+      int32_t fileno = read_le_int32_from_file(f);
+
+      if (tile_index < 0) {
         g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_BAD_DATA,
-                    "Can't read page length");
-        goto DONE;
+                    "tile_index < 0");
+        return;
+      }
+      if (offset < 0) {
+        g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_BAD_DATA,
+                    "offset < 0");
+        return;
+      }
+      if (length < 0) {
+        g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_BAD_DATA,
+                    "length < 0");
+        return;
+      }
+      if (fileno < 0) {
+        g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_BAD_DATA,
+                    "fileno < 0");
+        return;
       }
 
-      //    g_debug("page_len: %d", page_len);
+      // we have only encountered images with exactly power-of-two scale
+      // factors, and there appears to be no clear way to specify otherwise,
+      // so require it
+      int32_t x = tile_index % zp->tiles_across;
+      int32_t y = tile_index / zp->tiles_across;
 
-      // read "next" pointer
-      next_ptr = read_le_int32_from_file(f);
-      if (next_ptr == -1) {
+      if (y >= zp->tiles_down) {
         g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_BAD_DATA,
-                    "Cannot read \"next\" pointer");
-        goto DONE;
+                    "y (%d) outside of bounds for zoom level (%d)",
+                    y, zoom_level);
+        return;
+      }
+
+      if (x % (1 << zoom_level)) {
+        g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_BAD_DATA,
+                    "x (%d) not correct multiple for zoom level (%d)",
+                    x, zoom_level);
+        return;
+      }
+      if (y % (1 << zoom_level)) {
+        g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_BAD_DATA,
+                    "y (%d) not correct multiple for zoom level (%d)",
+                    y, zoom_level);
+        return;
+      }
+
+      // save filename
+      if (fileno >= zp->datafile_count) {
+        g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_BAD_DATA,
+                    "Invalid fileno");
+        return;
+      }
+      char *filename = g_build_filename(zp->dirname,
+                                        zp->datafile_names[fileno], NULL);
+
+      // hash in the lowest-res on-disk tiles
+      if (zoom_level == zp->zoom_levels - 1) {
+        if (!_openslide_hash_file_part(zp->quickhash1, filename,
+                                       offset, length, err)) {
+          g_free(filename);
+          g_prefix_error(err, "Can't hash tiles: ");
+          return;
+        }
       }
 
-      // read all the data into the list
-      for (int i = 0; i < page_len; i++) {
-	int32_t tile_index = read_le_int32_from_file(f);
-	int32_t offset = read_le_int32_from_file(f);
-	int32_t length = read_le_int32_from_file(f);
-	int32_t fileno = read_le_int32_from_file(f);
-
-	if (tile_index < 0) {
-          g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_BAD_DATA,
-                      "tile_index < 0");
-          goto DONE;
-	}
-	if (offset < 0) {
-          g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_BAD_DATA,
-                      "offset < 0");
-          goto DONE;
-	}
-	if (length < 0) {
-          g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_BAD_DATA,
-                      "length < 0");
-          goto DONE;
-	}
-	if (fileno < 0) {
-          g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_BAD_DATA,
-                      "fileno < 0");
-          goto DONE;
-	}
-
-	// we have only encountered images with exactly power-of-two scale
-	// factors, and there appears to be no clear way to specify otherwise,
-	// so require it
-	int32_t x = tile_index % tiles_across;
-	int32_t y = tile_index / tiles_across;
-
-	if (y >= tiles_down) {
-          g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_BAD_DATA,
-                      "y (%d) outside of bounds for zoom level (%d)",
-                      y, zoom_level);
-          goto DONE;
-	}
-
-	if (x % (1 << zoom_level)) {
-          g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_BAD_DATA,
-                      "x (%d) not correct multiple for zoom level (%d)",
-                      x, zoom_level);
-          goto DONE;
-	}
-	if (y % (1 << zoom_level)) {
-          g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_BAD_DATA,
-                      "y (%d) not correct multiple for zoom level (%d)",
-                      y, zoom_level);
-          goto DONE;
-	}
-
-	// save filename
-	if (fileno >= datafile_count) {
-          g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_BAD_DATA,
-                      "Invalid fileno");
-          goto DONE;
-	}
-	char *filename = g_build_filename(dirname, datafile_names[fileno], NULL);
-
-	// hash in the lowest-res on-disk tiles
-	if (zoom_level == zoom_levels - 1) {
-	  if (!_openslide_hash_file_part(quickhash1, filename, offset, length, err)) {
-            g_free(filename);
-            g_prefix_error(err, "Can't hash tiles: ");
-            goto DONE;
-	  }
-	}
-
-	// populate the file structure
-	struct _openslide_jpeg_file *jpeg = g_slice_new0(struct _openslide_jpeg_file);
-	jpeg->filename = filename;
-	jpeg->start_in_file = offset;
-	jpeg->end_in_file = jpeg->start_in_file + length;
-	jpeg->tw = l->raw_tile_width;
-	jpeg->th = l->raw_tile_height;
-	jpeg->w = l->raw_tile_width;
-	jpeg->h = l->raw_tile_height;
-
-	*jpegs_list = g_list_prepend(*jpegs_list, jpeg);
-
-	/*
-	g_debug("tile_concat: %d, subtiles_per_jpeg_tile: %d",
-		lp->tile_concat, lp->subtiles_per_jpeg_tile);
-	g_debug("found %d %d from file", x, y);
-	*/
-
-
-	// start processing 1 JPEG tile into subtiles_per_jpeg_tile^2 subtiles
-	for (int yi = 0; yi < lp->subtiles_per_jpeg_tile; yi++) {
-	  int yy = y + (yi * image_divisions);
-	  if (yy >= tiles_down) {
-	    break;
-	  }
-
-	  for (int xi = 0; xi < lp->subtiles_per_jpeg_tile; xi++) {
-	    int xx = x + (xi * image_divisions);
-	    if (xx >= tiles_across) {
-	      break;
-	    }
-
-	    // xx and yy are the tile coordinates in level0 space
-
-	    // position in level 0
-            int pos0_x;
-            int pos0_y;
-            if (!get_subtile_position(tile_positions,
-                                      active_positions,
-                                      slide_zoom_level_params,
-                                      levels,
-                                      tiles_across,
-                                      image_divisions,
-                                      zoom_level,
-                                      xx, yy,
-                                      &pos0_x, &pos0_y)) {
-              // no such position
-              continue;
-            }
-
-	    // position in this level
-	    const double pos_x = ((double) pos0_x) / lp->tile_concat;
-	    const double pos_y = ((double) pos0_y) / lp->tile_concat;
-
-	    //g_debug("pos0: %d %d, pos: %g %g", pos0_x, pos0_y, pos_x, pos_y);
-
-	    insert_subtile(l->tiles, jpeg_number,
-			   pos_x, pos_y,
-			   lp->subtile_w * xi, lp->subtile_h * yi,
-			   lp->subtile_w, lp->subtile_h,
-			   l->tile_advance_x, l->tile_advance_y,
-			   x / lp->tile_count_divisor + xi,
-			   y / lp->tile_count_divisor + yi,
-			   l->tiles_across,
-			   zoom_level);
-	  }
-	}
-	jpeg_number++;
+      // populate the file structure
+      struct _openslide_jpeg_file *jpeg = g_slice_new0(struct _openslide_jpeg_file);
+      jpeg->filename = filename;
+      jpeg->start_in_file = offset;
+      jpeg->end_in_file = jpeg->start_in_file + length;
+      jpeg->tw = l->raw_tile_width;
+      jpeg->th = l->raw_tile_height;
+      jpeg->w = l->raw_tile_width;
+      jpeg->h = l->raw_tile_height;
+
+      zp->jpegs_list = g_list_prepend(zp->jpegs_list, jpeg);
+
+      /*
+      g_debug("tile_concat: %d, subtiles_per_jpeg_tile: %d",
+	      lp->tile_concat, lp->subtiles_per_jpeg_tile);
+      g_debug("found %d %d from file", x, y);
+      */
+
+
+      // start processing 1 JPEG tile into subtiles_per_jpeg_tile^2 subtiles
+      for (int yi = 0; yi < lp->subtiles_per_jpeg_tile; yi++) {
+        int yy = y + (yi * zp->image_divisions);
+        if (yy >= zp->tiles_down) {
+          break;
+        }
+
+        for (int xi = 0; xi < lp->subtiles_per_jpeg_tile; xi++) {
+          int xx = x + (xi * zp->image_divisions);
+          if (xx >= zp->tiles_across) {
+            break;
+          }
+
+          // xx and yy are the tile coordinates in level0 space
+
+          // position in level 0
+          int pos0_x;
+          int pos0_y;
+          if (!get_subtile_position(zp->tile_positions,
+                                    zp->active_positions,
+                                    zp->slide_zoom_level_params,
+                                    zp->levels,
+                                    zp->tiles_across,
+                                    zp->image_divisions,
+                                    zoom_level,
+                                    xx, yy,
+                                    &pos0_x, &pos0_y)) {
+            // no such position
+            continue;
+          }
+
+          // position in this level
+          const double pos_x = ((double) pos0_x) / lp->tile_concat;
+          const double pos_y = ((double) pos0_y) / lp->tile_concat;
+
+          //g_debug("pos0: %d %d, pos: %g %g", pos0_x, pos0_y, pos_x, pos_y);
+
+          insert_subtile(l->tiles, jpeg_number,
+                         pos_x, pos_y,
+                         lp->subtile_w * xi, lp->subtile_h * yi,
+                         lp->subtile_w, lp->subtile_h,
+                         l->tile_advance_x, l->tile_advance_y,
+                         x / lp->tile_count_divisor + xi,
+                         y / lp->tile_count_divisor + yi,
+                         l->tiles_across,
+                         zoom_level);
+        }
       }
-    } while (next_ptr != 0);
+      jpeg_number++;
+    }
+  } while (next_ptr != 0);
 
-    // advance for next zoom level
-    seek_location += 4;
+  zp->jpeg_count = jpeg_number;
+}
+
+static void *zoom_level_parse_thread(void *data) {
+  struct zoom_level_parse *zp = data;
+
+  // each thread gets its own handle on the index file
+  FILE *f = _openslide_fopen(zp->index_path, "rb", &zp->err);
+  if (f == NULL) {
+    return NULL;
   }
+  process_one_zoom_level(f, zp);
+  fclose(f);
+  return NULL;
+}
 
-  success = true;
+static void offset_tile_fileno(gpointer key G_GNUC_UNUSED,
+                               gpointer value,
+                               gpointer user_data) {
+  struct _openslide_jpeg_tile *tile = value;
+  tile->fileno += GPOINTER_TO_INT(user_data);
+}
 
- DONE:
+static bool process_hier_data_pages_from_indexfile(FILE *f,
+						   const char *index_path,
+						   int64_t seek_location,
+						   int datafile_count,
+						   char **datafile_names,
+						   const char *dirname,
+						   int zoom_levels,
+						   struct _openslide_jpeg_level **levels,
+						   int tiles_across,
+						   int tiles_down,
+						   int image_divisions,
+						   const struct slide_zoom_level_params *slide_zoom_level_params,
+						   int32_t *tile_positions,
+						   GList **jpegs_list,
+						   struct _openslide_hash *quickhash1,
+						   GError **err) {
+  bool success = true;
+
+  // used for storing which positions actually have data
+  GHashTable *active_positions = g_hash_table_new_full(g_int_hash, g_int_equal,
+						       g_free, NULL);
+
+  struct zoom_level_parse *zp = g_new0(struct zoom_level_parse, zoom_levels);
+  for (int i = 0; i < zoom_levels; i++) {
+    zp[i].index_path = index_path;
+    zp[i].seek_location = seek_location + 4 * i;
+    zp[i].datafile_count = datafile_count;
+    zp[i].datafile_names = datafile_names;
+    zp[i].dirname = dirname;
+    zp[i].zoom_levels = zoom_levels;
+    zp[i].levels = levels;
+    zp[i].tiles_across = tiles_across;
+    zp[i].tiles_down = tiles_down;
+    zp[i].image_divisions = image_divisions;
+    zp[i].slide_zoom_level_params = slide_zoom_level_params;
+    zp[i].tile_positions = tile_positions;
+    zp[i].active_positions = active_positions;
+    zp[i].quickhash1 = quickhash1;
+    zp[i].zoom_level = i;
+  }
+
+  // zoom level 0 populates active_positions, so it must complete before
+  // the other levels start; parse it here with the handle we were given
+  process_one_zoom_level(f, &zp[0]);
+
+  // fan the remaining levels out, one thread each; they only read the
+  // shared state, and each inserts into its own level's tile table
+  if (zp[0].err == NULL && zoom_levels > 1) {
+    GThread **threads = g_new0(GThread *, zoom_levels);
+    for (int i = 1; i < zoom_levels; i++) {
+      threads[i] = g_thread_create(zoom_level_parse_thread, &zp[i],
+                                   TRUE, NULL);
+      if (threads[i] == NULL) {
+        // no thread to be had; parse it here
+        zoom_level_parse_thread(&zp[i]);
+      }
+    }
+    for (int i = 1; i < zoom_levels; i++) {
+      if (threads[i]) {
+        g_thread_join(threads[i]);
+      }
+    }
+    g_free(threads);
+  }
+
+  // merge in level order.  each level numbered its files from zero, so
+  // renumber tiles to point into the combined file list
+  int32_t fileno_offset = 0;
+  for (int i = 0; i < zoom_levels; i++) {
+    if (zp[i].err) {
+      if (success) {
+        g_propagate_error(err, zp[i].err);
+        success = false;
+      } else {
+        g_clear_error(&zp[i].err);
+      }
+    }
+    if (success && fileno_offset > 0) {
+      g_hash_table_foreach(levels[i]->tiles, offset_tile_fileno,
+                           GINT_TO_POINTER(fileno_offset));
+    }
+    // hand the files over even on failure, so the caller can free them
+    *jpegs_list = g_list_concat(*jpegs_list,
+                                g_list_reverse(zp[i].jpegs_list));
+    fileno_offset += zp[i].jpeg_count;
+  }
+
+  g_free(zp);
   g_hash_table_unref(active_positions);
 
   return success;
@@ -840,6 +952,7 @@ static bool process_indexfile(const char *uuid,
 			      int image_divisions,
 			      const struct slide_zoom_level_params *slide_zoom_level_params,
 			      FILE *indexfile,
+			      const char *index_path,
 			      struct _openslide_jpeg_level **levels,
 			      int *file_count_out,
 			      struct _openslide_jpeg_file ***files_out,
@@ -1030,6 +1143,7 @@ static bool process_indexfile(const char *uuid,
 
   // read these pages in
   if (!process_hier_data_pages_from_indexfile(indexfile,
+					      index_path,
 					      ptr,
 					      datafile_count,
 					      datafile_names,
@@ -1050,10 +1164,7 @@ static bool process_indexfile(const char *uuid,
   success = true;
 
  DONE:
-  // reverse list
-  jpegs_list = g_list_reverse(jpegs_list);
-
-  // copy file structures
+  // copy file structures (the list is already in index order)
   int jpeg_count = g_list_length(jpegs_list);
   jpegs = g_new(struct _openslide_jpeg_file *, jpeg_count);
 
@@ -1264,6 +1375,7 @@ bool _openslide_try_mirax(openslide_t *osr, const char *filename,
   int datafile_count = 0;
   char **datafile_names = NULL;
 
+  char *index_path = NULL;
   FILE *indexfile = NULL;
 
   GHashTable *associated_images = NULL;
@@ -1538,10 +1650,8 @@ bool _openslide_try_mirax(openslide_t *osr, const char *filename,
   */
 
   // read indexfile
-  tmp = g_build_filename(dirname, index_filename, NULL);
-  indexfile = _openslide_fopen(tmp, "rb", err);
-  g_free(tmp);
-  tmp = NULL;
+  index_path = g_build_filename(dirname, index_filename, NULL);
+  indexfile = _openslide_fopen(index_path, "rb", err);
 
   if (!indexfile) {
     goto FAIL;
@@ -1698,6 +1808,7 @@ bool _openslide_try_mirax(openslide_t *osr, const char *filename,
 			 image_divisions,
 			 slide_zoom_level_params,
 			 indexfile,
+			 index_path,
 			 levels,
 			 &num_jpegs, &jpegs,
 			 quickhash1,
@@ -1746,6 +1857,7 @@ bool _openslide_try_mirax(openslide_t *osr, const char *filename,
   g_free(slide_version);
   g_free(slide_id);
   g_free(index_filename);
+  g_free(index_path);
   g_strfreev(datafile_names);
   g_strfreev(slide_zoom_level_section_names);
   g_free(slide_zoom_level_sections);
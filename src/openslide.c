@@ -23,15 +23,19 @@
 
 #include "openslide-private.h"
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <libxml/parser.h>
 
 #include "openslide-cache.h"
 #include "openslide-tilehelper.h"
 #include "openslide-cairo.h"
+#include "openslide-pixelops.h"
 
 const char _openslide_release_info[] = "OpenSlide " PACKAGE_VERSION ", copyright (C) 2007-2013 Carnegie Mellon University and others.\nLicensed under the GNU Lesser General Public License, version 2.1.";
 
@@ -53,8 +57,189 @@ static const _openslide_tiff_vendor_fn tiff_formats[] = {
   NULL
 };
 
+// the vendor property value each probe sets, parallel to the tables
+// above; used to route the sidecar profile's vendor hint back to a probe
+static const char * const non_tiff_format_names[] = {
+  "mirax",
+  "hamamatsu",
+  NULL
+};
+
+static const char * const tiff_format_names[] = {
+  "trestle",
+  "aperio",
+  "leica",
+  "ventana",
+  "generic-tiff",
+  NULL
+};
+
+static _openslide_vendor_fn non_tiff_format_by_name(const char *name) {
+  for (int i = 0; name != NULL && non_tiff_format_names[i] != NULL; i++) {
+    if (strcmp(name, non_tiff_format_names[i]) == 0) {
+      return non_tiff_formats[i];
+    }
+  }
+  return NULL;
+}
+
+static _openslide_tiff_vendor_fn tiff_format_by_name(const char *name) {
+  for (int i = 0; name != NULL && tiff_format_names[i] != NULL; i++) {
+    if (strcmp(name, tiff_format_names[i]) == 0) {
+      return tiff_formats[i];
+    }
+  }
+  return NULL;
+}
+
+// stable identifier for the disk tile store.  quickhash1 would also
+// work, but it is computed lazily and hashing the whole slide at open
+// would defeat that; size and mtime in the identity keep a modified
+// slide from reusing stale tiles
+static char *compute_slide_id(const char *filename) {
+  GStatBuf st;
+  if (g_stat(filename, &st)) {
+    return NULL;
+  }
+
+  char *ident = g_strdup_printf("%s|%" G_GINT64_FORMAT "|%" G_GINT64_FORMAT,
+				filename, (int64_t) st.st_size,
+				(int64_t) st.st_mtime);
+  char *slide_id = g_compute_checksum_for_string(G_CHECKSUM_MD5, ident, -1);
+  g_free(ident);
+  return slide_id;
+}
+
+/*
+ * Slide profile sidecar, enabled by setting OPENSLIDE_SLIDE_PROFILES in
+ * the environment.  The profile records what the previous open of a
+ * slide worked out the hard way -- which vendor probe matched and the
+ * quickhash-1 digest -- keyed by the same identity as the disk tile
+ * store, so a modified slide invalidates its profile.  A reopen with a
+ * valid profile goes straight to the right probe and never reads the
+ * slide back for hashing.
+ */
+#define PROFILE_SUFFIX ".openslide-profile"
+#define PROFILE_GROUP "openslide-profile"
+#define PROFILE_KEY_SLIDE_ID "slide-id"
+#define PROFILE_KEY_VENDOR "vendor"
+#define PROFILE_KEY_QUICKHASH1 "quickhash-1"
+
+static void load_profile(const char *path, const char *slide_id,
+			 char **vendor, char **quickhash1) {
+  GKeyFile *kf = g_key_file_new();
+  if (_openslide_read_key_file(kf, path, G_KEY_FILE_NONE, NULL)) {
+    char *recorded_id = g_key_file_get_string(kf, PROFILE_GROUP,
+					      PROFILE_KEY_SLIDE_ID, NULL);
+    if (recorded_id != NULL && strcmp(recorded_id, slide_id) == 0) {
+      *vendor = g_key_file_get_string(kf, PROFILE_GROUP,
+				      PROFILE_KEY_VENDOR, NULL);
+      *quickhash1 = g_key_file_get_string(kf, PROFILE_GROUP,
+					  PROFILE_KEY_QUICKHASH1, NULL);
+    }
+    g_free(recorded_id);
+  }
+  g_key_file_free(kf);
+}
+
+// best effort, like the disk tile store: a failure just leaves the
+// next open no faster than today
+static void save_profile(openslide_t *osr) {
+  if (osr->profile_path == NULL || openslide_get_error(osr)) {
+    return;
+  }
+
+  bool have_digest = (osr->quickhash1 != NULL &&
+		      _openslide_hash_has_digest(osr->quickhash1));
+
+  // nothing to add to what was loaded at open?
+  if (osr->profile_loaded &&
+      (osr->profile_had_quickhash1 || !have_digest)) {
+    return;
+  }
+
+  const char *vendor = g_hash_table_lookup(osr->properties,
+					   OPENSLIDE_PROPERTY_NAME_VENDOR);
+  if (vendor == NULL) {
+    return;
+  }
+
+  GKeyFile *kf = g_key_file_new();
+  g_key_file_set_string(kf, PROFILE_GROUP, PROFILE_KEY_SLIDE_ID,
+			osr->slide_id);
+  g_key_file_set_string(kf, PROFILE_GROUP, PROFILE_KEY_VENDOR, vendor);
+  if (have_digest) {
+    g_key_file_set_string(kf, PROFILE_GROUP, PROFILE_KEY_QUICKHASH1,
+			  _openslide_hash_get_string(osr->quickhash1));
+  }
+
+  gsize len;
+  char *buf = g_key_file_to_data(kf, &len, NULL);
+  g_key_file_free(kf);
+
+  FILE *f = _openslide_fopen(osr->profile_path, "wb", NULL);
+  if (f != NULL) {
+    bool ok = (fwrite(buf, len, 1, f) == 1);
+    if (fclose(f) || !ok) {
+      // don't leave a truncated profile behind
+      remove(osr->profile_path);
+    }
+  }
+  g_free(buf);
+}
+
+static bool has_extension(const char *filename, const char *ext) {
+  size_t flen = strlen(filename);
+  size_t elen = strlen(ext);
+  return flen >= elen &&
+    g_ascii_strcasecmp(filename + flen - elen, ext) == 0;
+}
+
+// map an unambiguous filename extension to its vendor probe
+static _openslide_vendor_fn sniff_non_tiff_format(const char *filename) {
+  if (has_extension(filename, ".mrxs")) {
+    return _openslide_try_mirax;
+  }
+  if (has_extension(filename, ".vms") || has_extension(filename, ".vmu")) {
+    return _openslide_try_hamamatsu;
+  }
+  return NULL;
+}
+
+// does the file start with a TIFF (or BigTIFF) magic number?
+static bool sniff_tiff_magic(const char *filename) {
+  FILE *f = _openslide_fopen(filename, "rb", NULL);
+  if (f == NULL) {
+    return false;
+  }
+
+  uint8_t buf[4];
+  bool result = false;
+  if (fread(buf, sizeof buf, 1, f) == 1) {
+    result = (memcmp(buf, "II\x2a\x00", 4) == 0 ||
+	      memcmp(buf, "MM\x00\x2a", 4) == 0 ||
+	      memcmp(buf, "II\x2b\x00", 4) == 0 ||
+	      memcmp(buf, "MM\x00\x2b", 4) == 0);
+  }
+  fclose(f);
+  return result;
+}
+
 static bool openslide_was_dynamically_loaded;
 
+// tile cache budget for newly-opened slides; atomic ops only
+static gint default_cache_size = _OPENSLIDE_USEFUL_CACHE_SIZE;
+
+// shared cache that subsequently-opened slides attach to, or NULL for
+// per-slide caches
+static GStaticMutex shared_cache_lock = G_STATIC_MUTEX_INIT;
+static struct _openslide_cache *shared_cache;
+
+// clamp a public byte count to what the cache implementation supports
+static int clamp_cache_size(int64_t capacity) {
+  return MIN(MAX(capacity, 0), G_MAXINT);
+}
+
 // called from shared-library constructor!
 static void __attribute__((constructor)) _openslide_init(void) {
   // activate threads
@@ -69,6 +254,7 @@ static void destroy_associated_image(gpointer data) {
   if (img->destroy_ctx != NULL && img->ctx != NULL) {
     img->destroy_ctx(img->ctx);
   }
+  g_free(img->argb_data);
   g_slice_free(struct _openslide_associated_image, img);
 }
 
@@ -84,6 +270,9 @@ static bool level_in_range(openslide_t *osr, int32_t level) {
   return true;
 }
 
+// defined with the other prefetch code below
+static void destroy_prefetch(openslide_t *osr);
+
 static void reset_osr(openslide_t *osr) {
   if (osr) {
     g_hash_table_remove_all(osr->properties);
@@ -156,34 +345,29 @@ static bool try_tiff_format(openslide_t *osr, TIFF *tiff,
   return result;
 }
 
-static bool try_all_formats(openslide_t *osr, const char *filename,
-			    struct _openslide_hash **quickhash1_OUT,
-			    GError **err) {
+static bool try_tiff_formats(openslide_t *osr, const char *filename,
+			     struct _openslide_hash **quickhash1_OUT,
+			     _openslide_tiff_vendor_fn preferred,
+			     GError **err) {
   GError *tmp_err = NULL;
 
-  // non-tiff
-  const _openslide_vendor_fn *fn = non_tiff_formats;
-  while (*fn) {
-    if (try_format(osr, filename, quickhash1_OUT, fn, &tmp_err)) {
-      return true;
+  TIFF *tiff = _openslide_tiff_open(filename);
+  if (tiff != NULL) {
+    // the preferred probe (from a sidecar profile) goes first; a stale
+    // hint just falls through to the rest of the chain
+    _openslide_tiff_vendor_fn ordered[G_N_ELEMENTS(tiff_formats)];
+    int count = 0;
+    if (preferred != NULL) {
+      ordered[count++] = preferred;
     }
-    if (!g_error_matches(tmp_err, OPENSLIDE_ERROR,
-                         OPENSLIDE_ERROR_FORMAT_NOT_SUPPORTED)) {
-      g_propagate_error(err, tmp_err);
-      return false;
+    for (const _openslide_tiff_vendor_fn *tfn = tiff_formats; *tfn; tfn++) {
+      if (*tfn != preferred) {
+	ordered[count++] = *tfn;
+      }
     }
-    //g_debug("%s", tmp_err->message);
-    g_clear_error(&tmp_err);
-    fn++;
-  }
-
 
-  // tiff
-  TIFF *tiff = _openslide_tiff_open(filename);
-  if (tiff != NULL) {
-    const _openslide_tiff_vendor_fn *tfn = tiff_formats;
-    while (*tfn) {
-      if (try_tiff_format(osr, tiff, quickhash1_OUT, tfn, &tmp_err)) {
+    for (int i = 0; i < count; i++) {
+      if (try_tiff_format(osr, tiff, quickhash1_OUT, &ordered[i], &tmp_err)) {
 	return true;
       }
       if (!g_error_matches(tmp_err, OPENSLIDE_ERROR,
@@ -194,25 +378,91 @@ static bool try_all_formats(openslide_t *osr, const char *filename,
       }
       //g_debug("%s", tmp_err->message);
       g_clear_error(&tmp_err);
-      tfn++;
     }
 
     // close only if failed
     TIFFClose(tiff);
   }
 
-
   // no match
   g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FORMAT_NOT_SUPPORTED,
               "Format not recognized");
   return false;
 }
 
+static bool try_all_formats(openslide_t *osr, const char *filename,
+			    struct _openslide_hash **quickhash1_OUT,
+			    const char *vendor_hint,
+			    GError **err) {
+  GError *tmp_err = NULL;
+
+  // a sidecar profile names the vendor that matched last time; trying
+  // it first skips the detection chain on the reopen path.  TIFF hints
+  // are threaded down to try_tiff_formats instead
+  _openslide_tiff_vendor_fn tiff_hinted = tiff_format_by_name(vendor_hint);
+  _openslide_vendor_fn hinted = non_tiff_format_by_name(vendor_hint);
+  if (hinted != NULL) {
+    const _openslide_vendor_fn hinted_formats[] = { hinted, NULL };
+    if (try_format(osr, filename, quickhash1_OUT, hinted_formats,
+                   &tmp_err)) {
+      return true;
+    }
+    if (!g_error_matches(tmp_err, OPENSLIDE_ERROR,
+                         OPENSLIDE_ERROR_FORMAT_NOT_SUPPORTED)) {
+      g_propagate_error(err, tmp_err);
+      return false;
+    }
+    //g_debug("%s", tmp_err->message);
+    g_clear_error(&tmp_err);
+  }
+
+  // cheap sniff first, so opening a slide doesn't pay for every other
+  // vendor's probe.  A wrong guess just falls through to the full chain
+  _openslide_vendor_fn sniffed = sniff_non_tiff_format(filename);
+  if (sniffed != NULL && sniffed != hinted) {
+    const _openslide_vendor_fn sniffed_formats[] = { sniffed, NULL };
+    if (try_format(osr, filename, quickhash1_OUT, sniffed_formats,
+                   &tmp_err)) {
+      return true;
+    }
+    if (!g_error_matches(tmp_err, OPENSLIDE_ERROR,
+                         OPENSLIDE_ERROR_FORMAT_NOT_SUPPORTED)) {
+      g_propagate_error(err, tmp_err);
+      return false;
+    }
+    //g_debug("%s", tmp_err->message);
+    g_clear_error(&tmp_err);
+  } else if (sniffed == NULL && sniff_tiff_magic(filename)) {
+    // a TIFF container can't be a MIRAX index or a Hamamatsu key file,
+    // so go straight to the tag-based vendor probes
+    return try_tiff_formats(osr, filename, quickhash1_OUT, tiff_hinted, err);
+  }
+
+  // non-tiff
+  const _openslide_vendor_fn *fn = non_tiff_formats;
+  while (*fn) {
+    if (try_format(osr, filename, quickhash1_OUT, fn, &tmp_err)) {
+      return true;
+    }
+    if (!g_error_matches(tmp_err, OPENSLIDE_ERROR,
+                         OPENSLIDE_ERROR_FORMAT_NOT_SUPPORTED)) {
+      g_propagate_error(err, tmp_err);
+      return false;
+    }
+    //g_debug("%s", tmp_err->message);
+    g_clear_error(&tmp_err);
+    fn++;
+  }
+
+  // tiff
+  return try_tiff_formats(osr, filename, quickhash1_OUT, tiff_hinted, err);
+}
+
 bool openslide_can_open(const char *filename) {
   g_assert(openslide_was_dynamically_loaded);
 
   // quick test
-  return try_all_formats(NULL, filename, NULL, NULL);
+  return try_all_formats(NULL, filename, NULL, NULL, NULL);
 }
 
 
@@ -252,14 +502,35 @@ openslide_t *openslide_open(const char *filename) {
 
   // alloc memory
   openslide_t *osr = g_slice_new0(openslide_t);
+  osr->prefetch_mutex = g_mutex_new();
   osr->properties = g_hash_table_new_full(g_str_hash, g_str_equal,
 					  g_free, g_free);
   osr->associated_images = g_hash_table_new_full(g_str_hash, g_str_equal,
 						 g_free, destroy_associated_image);
 
+  // consult the profile sidecar, if enabled and still valid
+  char *profile_path = NULL;
+  char *slide_id = NULL;
+  char *profile_vendor = NULL;
+  char *profile_quickhash1 = NULL;
+  if (g_getenv("OPENSLIDE_SLIDE_PROFILES")) {
+    slide_id = compute_slide_id(filename);
+    if (slide_id != NULL) {
+      profile_path = g_strconcat(filename, PROFILE_SUFFIX, NULL);
+      load_profile(profile_path, slide_id, &profile_vendor,
+		   &profile_quickhash1);
+    }
+  }
+
   // try to read it
   struct _openslide_hash *quickhash1 = NULL;
-  if (!try_all_formats(osr, filename, &quickhash1, &tmp_err)) {
+  if (!try_all_formats(osr, filename, &quickhash1, profile_vendor,
+		       &tmp_err)) {
+    g_free(profile_path);
+    g_free(slide_id);
+    g_free(profile_vendor);
+    g_free(profile_quickhash1);
+
     // failure
     if (g_error_matches(tmp_err, OPENSLIDE_ERROR,
                         OPENSLIDE_ERROR_FORMAT_NOT_SUPPORTED)) {
@@ -275,6 +546,14 @@ openslide_t *openslide_open(const char *filename) {
     }
   }
 
+  // the close path owns these now, and writes the profile back if
+  // this open learned anything new
+  osr->profile_path = profile_path;
+  osr->slide_id = slide_id;
+  osr->profile_loaded = (profile_vendor != NULL);
+  osr->profile_had_quickhash1 = (profile_quickhash1 != NULL);
+  g_free(profile_vendor);
+
   // compute downsamples if not done already
   int64_t blw, blh;
   openslide_get_level0_dimensions(osr, &blw, &blh);
@@ -305,18 +584,26 @@ openslide_t *openslide_open(const char *filename) {
 		osr->downsamples[i], osr->downsamples[i - 1]);
       openslide_close(osr);
       _openslide_hash_destroy(quickhash1);
+      g_free(profile_quickhash1);
       return NULL;
     }
   }
 
-  // set hash property
-  const char *hash_str = _openslide_hash_get_string(quickhash1);
-  if (hash_str != NULL) {
+  // set hash property; the digest itself is computed on first access
+  if (_openslide_hash_is_enabled(quickhash1)) {
+    // placeholder so the name enumerates; the getter intercepts reads
     g_hash_table_insert(osr->properties,
                         g_strdup(OPENSLIDE_PROPERTY_NAME_QUICKHASH1),
-                        g_strdup(hash_str));
+                        g_strdup(""));
+    if (profile_quickhash1 != NULL) {
+      // believe the sidecar; recomputing would read the slide back
+      _openslide_hash_set_digest(quickhash1, profile_quickhash1);
+    }
+    osr->quickhash1 = quickhash1;
+  } else {
+    _openslide_hash_destroy(quickhash1);
   }
-  _openslide_hash_destroy(quickhash1);
+  g_free(profile_quickhash1);
 
   // set other properties
   g_hash_table_insert(osr->properties,
@@ -361,9 +648,28 @@ openslide_t *openslide_open(const char *filename) {
   osr->associated_image_names = strv_from_hashtable_keys(osr->associated_images);
   osr->property_names = strv_from_hashtable_keys(osr->properties);
 
-  // start cache
-  osr->cache = _openslide_cache_create(_OPENSLIDE_USEFUL_CACHE_SIZE);
-  //osr->cache = _openslide_cache_create(0);
+  // start cache; attach to the shared cache if one is configured
+  g_static_mutex_lock(&shared_cache_lock);
+  if (shared_cache != NULL) {
+    osr->cache = _openslide_cache_ref(shared_cache);
+    osr->cache_is_shared = true;
+  }
+  g_static_mutex_unlock(&shared_cache_lock);
+  if (osr->cache == NULL) {
+    osr->cache = _openslide_cache_create(g_atomic_int_get(&default_cache_size));
+    //osr->cache = _openslide_cache_create(0);
+  }
+
+  // optionally spill evicted tiles to a store that survives the process.
+  // the store directory is per-slide, so it only works on a private cache
+  if (!osr->cache_is_shared && g_getenv("OPENSLIDE_TILE_CACHE_DIR")) {
+    char *store_id = osr->slide_id ? g_strdup(osr->slide_id)
+      : compute_slide_id(filename);
+    if (store_id) {
+      _openslide_cache_set_disk_store(osr->cache, store_id);
+      g_free(store_id);
+    }
+  }
 
   // validate required properties
   g_assert(openslide_get_property_value(osr, OPENSLIDE_PROPERTY_NAME_VENDOR));
@@ -373,10 +679,23 @@ openslide_t *openslide_open(const char *filename) {
 
 
 void openslide_close(openslide_t *osr) {
+  // stop prefetching before tearing down the backend
+  destroy_prefetch(osr);
+
+  // record what this open learned, for the next one
+  save_profile(osr);
+
   if (osr->ops) {
     (osr->ops->destroy)(osr);
   }
 
+  if (osr->quickhash1) {
+    _openslide_hash_destroy(osr->quickhash1);
+  }
+
+  g_free(osr->profile_path);
+  g_free(osr->slide_id);
+
   g_hash_table_unref(osr->associated_images);
   g_hash_table_unref(osr->properties);
 
@@ -386,7 +705,11 @@ void openslide_close(openslide_t *osr) {
   g_free(osr->downsamples);
 
   if (osr->cache) {
-    _openslide_cache_destroy(osr->cache);
+    if (osr->cache_is_shared) {
+      // this pointer may be recycled by a future open
+      _openslide_cache_purge_owner(osr->cache, osr);
+    }
+    _openslide_cache_unref(osr->cache);
   }
 
   g_free(g_atomic_pointer_get(&osr->error));
@@ -486,21 +809,81 @@ double openslide_get_layer_downsample(openslide_t *osr, int32_t level) {
 }
 
 
-int openslide_give_prefetch_hint(openslide_t *osr G_GNUC_UNUSED,
-				 int64_t x G_GNUC_UNUSED,
-				 int64_t y G_GNUC_UNUSED,
-				 int32_t level G_GNUC_UNUSED,
-				 int64_t w G_GNUC_UNUSED,
-				 int64_t h G_GNUC_UNUSED) {
-  g_warning("openslide_give_prefetch_hint has never been implemented and should not be called");
-  return 0;
+void openslide_set_cache_size(openslide_t *osr, int64_t capacity) {
+  if (osr->cache == NULL) {
+    // object in error state before the cache was created
+    return;
+  }
+
+  _openslide_cache_set_capacity(osr->cache, clamp_cache_size(capacity));
+}
+
+int64_t openslide_get_cache_size(openslide_t *osr) {
+  if (openslide_get_error(osr) || osr->cache == NULL) {
+    return -1;
+  }
+
+  return _openslide_cache_get_capacity(osr->cache);
+}
+
+void openslide_set_default_cache_size(int64_t capacity) {
+  g_atomic_int_set(&default_cache_size, clamp_cache_size(capacity));
 }
 
-void openslide_cancel_prefetch_hint(openslide_t *osr G_GNUC_UNUSED,
-				    int prefetch_id G_GNUC_UNUSED) {
-  g_warning("openslide_cancel_prefetch_hint has never been implemented and should not be called");
+void openslide_set_shared_cache_size(int64_t capacity) {
+  int cap = clamp_cache_size(capacity);
+
+  g_static_mutex_lock(&shared_cache_lock);
+  if (cap == 0) {
+    // stop sharing for slides opened later; attached slides keep
+    // their reference until they close
+    if (shared_cache != NULL) {
+      _openslide_cache_unref(shared_cache);
+      shared_cache = NULL;
+    }
+  } else if (shared_cache == NULL) {
+    shared_cache = _openslide_cache_create(cap);
+  } else {
+    _openslide_cache_set_capacity(shared_cache, cap);
+  }
+  g_static_mutex_unlock(&shared_cache_lock);
 }
 
+
+static const char * const STAT_NAMES[] = {
+  OPENSLIDE_STAT_NAME_CACHE_HITS,
+  OPENSLIDE_STAT_NAME_CACHE_MISSES,
+  OPENSLIDE_STAT_NAME_TILES_DECODED,
+  OPENSLIDE_STAT_NAME_BYTES_DECODED,
+  NULL
+};
+
+const char * const *openslide_get_stat_names(openslide_t *osr) {
+  if (openslide_get_error(osr)) {
+    return EMPTY_STRING_ARRAY;
+  }
+
+  return STAT_NAMES;
+}
+
+int64_t openslide_get_stat(openslide_t *osr, const char *name) {
+  if (openslide_get_error(osr)) {
+    return -1;
+  }
+
+  if (!strcmp(name, OPENSLIDE_STAT_NAME_CACHE_HITS)) {
+    return _openslide_stat_get(&osr->stats.cache_hits);
+  } else if (!strcmp(name, OPENSLIDE_STAT_NAME_CACHE_MISSES)) {
+    return _openslide_stat_get(&osr->stats.cache_misses);
+  } else if (!strcmp(name, OPENSLIDE_STAT_NAME_TILES_DECODED)) {
+    return _openslide_stat_get(&osr->stats.tiles_decoded);
+  } else if (!strcmp(name, OPENSLIDE_STAT_NAME_BYTES_DECODED)) {
+    return _openslide_stat_get(&osr->stats.bytes_decoded);
+  }
+  return -1;
+}
+
+
 static void read_region(openslide_t *osr,
 			cairo_t *cr,
 			int64_t x, int64_t y,
@@ -556,42 +939,168 @@ static void read_region(openslide_t *osr,
   cairo_pattern_destroy(old_source);
 }
 
-static bool ensure_nonnegative_dimensions(openslide_t *osr, int64_t w, int64_t h) {
-  if (w < 0 || h < 0) {
-    _openslide_set_error(osr,
-			 "negative width (%" G_GINT64_FORMAT ") or negative height (%"
-			 G_GINT64_FORMAT ") not allowed", w, h);
-    return false;
+struct prefetch_hint {
+  openslide_t *osr;
+  int prefetch_id;
+  gint cancelled;  // atomic ops only
+
+  int64_t x;
+  int64_t y;
+  int32_t level;
+  int64_t w;
+  int64_t h;
+};
+
+static void run_prefetch_hint(gpointer data, gpointer user_data G_GNUC_UNUSED) {
+  struct prefetch_hint *hint = data;
+  openslide_t *osr = hint->osr;
+
+  // paint the region into nil surfaces, in the same chunks as
+  // openslide_read_region, purely to populate the tile cache;
+  // check for cancellation between chunks
+  const int64_t d = 4096;
+  double ds = openslide_get_level_downsample(osr, hint->level);
+  for (int64_t row = 0; row < (hint->h + d - 1) / d; row++) {
+    for (int64_t col = 0; col < (hint->w + d - 1) / d; col++) {
+      if (g_atomic_int_get(&hint->cancelled) || openslide_get_error(osr)) {
+	goto DONE;
+      }
+
+      int64_t sx = hint->x + col * d * ds;
+      int64_t sy = hint->y + row * d * ds;
+      int64_t sw = MIN(hint->w - col * d, d);
+      int64_t sh = MIN(hint->h - row * d, d);
+
+      cairo_surface_t *surface =
+	cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 0, 0);
+      cairo_t *cr = cairo_create(surface);
+      cairo_surface_destroy(surface);
+
+      read_region(osr, cr, sx, sy, hint->level, sw, sh);
+
+      _openslide_check_cairo_status_possibly_set_error(osr, cr);
+      cairo_destroy(cr);
+    }
   }
-  return true;
+
+ DONE:
+  g_mutex_lock(osr->prefetch_mutex);
+  g_hash_table_remove(osr->prefetch_hints,
+		      GINT_TO_POINTER(hint->prefetch_id));
+  g_mutex_unlock(osr->prefetch_mutex);
+  g_slice_free(struct prefetch_hint, hint);
 }
 
-void openslide_read_region(openslide_t *osr,
-			   uint32_t *dest,
-			   int64_t x, int64_t y,
-			   int32_t level,
-			   int64_t w, int64_t h) {
-  if (!ensure_nonnegative_dimensions(osr, w, h)) {
-    return;
+int openslide_give_prefetch_hint(openslide_t *osr,
+				 int64_t x, int64_t y,
+				 int32_t level,
+				 int64_t w, int64_t h) {
+  if (openslide_get_error(osr) || !level_in_range(osr, level) ||
+      w <= 0 || h <= 0) {
+    return 0;
   }
 
-  // clear the dest
-  if (dest) {
-    memset(dest, 0, w * h * 4);
+  struct prefetch_hint *hint = g_slice_new0(struct prefetch_hint);
+  hint->osr = osr;
+  hint->x = x;
+  hint->y = y;
+  hint->level = level;
+  hint->w = w;
+  hint->h = h;
+
+  g_mutex_lock(osr->prefetch_mutex);
+
+  // start the machinery on first use
+  if (osr->prefetch_pool == NULL) {
+    osr->prefetch_hints = g_hash_table_new(g_direct_hash, g_direct_equal);
+    // one thread, so prefetching never competes much with real reads
+    osr->prefetch_pool = g_thread_pool_new(run_prefetch_hint, NULL,
+					   1, FALSE, NULL);
   }
 
-  // now that it's cleared, return if an error occurred
-  if (openslide_get_error(osr)) {
+  // 0 means failure, so never issue it
+  int prefetch_id = ++osr->next_prefetch_id;
+  if (prefetch_id == 0) {
+    prefetch_id = ++osr->next_prefetch_id;
+  }
+  hint->prefetch_id = prefetch_id;
+
+  g_hash_table_insert(osr->prefetch_hints, GINT_TO_POINTER(prefetch_id),
+		      hint);
+  g_thread_pool_push(osr->prefetch_pool, hint, NULL);
+
+  g_mutex_unlock(osr->prefetch_mutex);
+
+  return prefetch_id;
+}
+
+void openslide_cancel_prefetch_hint(openslide_t *osr, int prefetch_id) {
+  if (prefetch_id == 0) {
     return;
   }
 
-  // Break the work into smaller pieces if the region is large, because:
-  // 1. Cairo will not allow surfaces larger than 32767 pixels on a side.
-  // 2. cairo_push_group() creates an intermediate surface backed by a
-  //    pixman_image_t, and Pixman requires that every byte of that image
-  //    be addressable in 31 bits.
-  // 3. We would like to constrain the intermediate surface to a reasonable
-  //    amount of RAM.
+  g_mutex_lock(osr->prefetch_mutex);
+  if (osr->prefetch_hints) {
+    struct prefetch_hint *hint =
+      g_hash_table_lookup(osr->prefetch_hints, GINT_TO_POINTER(prefetch_id));
+    if (hint) {
+      // the worker (or openslide_close) still owns the hint; just flag it
+      g_atomic_int_set(&hint->cancelled, 1);
+    }
+  }
+  g_mutex_unlock(osr->prefetch_mutex);
+}
+
+static void destroy_prefetch(openslide_t *osr) {
+  if (osr->prefetch_pool) {
+    // cancel everything
+    GHashTableIter iter;
+    gpointer value;
+    g_mutex_lock(osr->prefetch_mutex);
+    g_hash_table_iter_init(&iter, osr->prefetch_hints);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+      struct prefetch_hint *hint = value;
+      g_atomic_int_set(&hint->cancelled, 1);
+    }
+    g_mutex_unlock(osr->prefetch_mutex);
+
+    // wait for the running hint; discard queued ones
+    g_thread_pool_free(osr->prefetch_pool, TRUE, TRUE);
+    osr->prefetch_pool = NULL;
+
+    // free the hints that never ran
+    g_hash_table_iter_init(&iter, osr->prefetch_hints);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+      g_slice_free(struct prefetch_hint, value);
+    }
+    g_hash_table_unref(osr->prefetch_hints);
+    osr->prefetch_hints = NULL;
+  }
+
+  g_mutex_free(osr->prefetch_mutex);
+  osr->prefetch_mutex = NULL;
+}
+
+// Paint rows [row0, row0 + h) of the w-pixel-wide region anchored at
+// (x, y) into dest, which holds w x h pixels.  Break the work into
+// smaller pieces if the region is large, because:
+// 1. Cairo will not allow surfaces larger than 32767 pixels on a side.
+// 2. cairo_push_group() creates an intermediate surface backed by a
+//    pixman_image_t, and Pixman requires that every byte of that image
+//    be addressable in 31 bits.
+// 3. We would like to constrain the intermediate surface to a reasonable
+//    amount of RAM.
+// When the downsample is fractional, a chunk's origin generally cannot
+// be expressed exactly in level 0 coordinates: the truncated coordinate
+// is up to one level 0 pixel early.  Make up the difference with a
+// sub-pixel cairo translation, so every chunk (and every band handed to
+// this function by the streaming readers) keeps the sub-pixel phase of
+// the region anchor and adjacent pieces tile seamlessly.
+static void read_region_chunks(openslide_t *osr,
+			       uint32_t *dest,
+			       int64_t x, int64_t y,
+			       int32_t level,
+			       int64_t w, int64_t row0, int64_t h) {
   const int64_t d = 4096;
   double ds = openslide_get_level_downsample(osr, level);
   for (int64_t row = 0; !openslide_get_error(osr) && row < (h + d - 1) / d;
@@ -599,10 +1108,15 @@ void openslide_read_region(openslide_t *osr,
     for (int64_t col = 0; !openslide_get_error(osr) && col < (w + d - 1) / d;
             col++) {
       // calculate surface coordinates and size
-      int64_t sx = x + col * d * ds;     // level 0 plane
-      int64_t sy = y + row * d * ds;     // level 0 plane
-      int64_t sw = MIN(w - col * d, d);  // level plane
-      int64_t sh = MIN(h - row * d, d);  // level plane
+      int64_t sx = x + (int64_t) (col * d * ds);           // level 0 plane
+      int64_t sy = y + (int64_t) ((row0 + row * d) * ds);  // level 0 plane
+      int64_t sw = MIN(w - col * d, d);                    // level plane
+      int64_t sh = MIN(h - row * d, d);                    // level plane
+
+      // the sub-pixel part the truncation to sx/sy dropped, in level
+      // pixels; always in [0, 1)
+      double ex = (x - sx) / ds + col * d;
+      double ey = (y - sy) / ds + row0 + row * d;
 
       // create the cairo surface for the dest
       cairo_surface_t *surface;
@@ -618,15 +1132,203 @@ void openslide_read_region(openslide_t *osr,
       // create the cairo context
       cairo_t *cr = cairo_create(surface);
       cairo_surface_destroy(surface);
+      cairo_translate(cr, -ex, -ey);
 
-      // paint
-      read_region(osr, cr, sx, sy, level, sw, sh);
+      // paint; the shift can pull up to one extra row and column of
+      // source into view
+      read_region(osr, cr, sx, sy, level,
+		  sw + (ex > 0 ? 1 : 0), sh + (ey > 0 ? 1 : 0));
 
       // done
       _openslide_check_cairo_status_possibly_set_error(osr, cr);
       cairo_destroy(cr);
     }
   }
+}
+
+static bool ensure_nonnegative_dimensions(openslide_t *osr, int64_t w, int64_t h) {
+  if (w < 0 || h < 0) {
+    _openslide_set_error(osr,
+			 "negative width (%" G_GINT64_FORMAT ") or negative height (%"
+			 G_GINT64_FORMAT ") not allowed", w, h);
+    return false;
+  }
+  return true;
+}
+
+void openslide_read_region(openslide_t *osr,
+			   uint32_t *dest,
+			   int64_t x, int64_t y,
+			   int32_t level,
+			   int64_t w, int64_t h) {
+  if (!ensure_nonnegative_dimensions(osr, w, h)) {
+    return;
+  }
+
+  // clear the dest
+  if (dest) {
+    memset(dest, 0, w * h * 4);
+  }
+
+  // now that it's cleared, return if an error occurred
+  if (openslide_get_error(osr)) {
+    return;
+  }
+
+  // fast path: for requests that map onto integer coordinates in the
+  // level, some backends can copy rows straight into dest, skipping
+  // cairo compositing entirely
+  if (dest && w > 0 && h > 0 &&
+      osr->ops->read_region_raw && level_in_range(osr, level) &&
+      x >= 0 && y >= 0) {
+    if ((osr->ops->read_region_raw)(osr, dest, w, x, y, level, w, h)) {
+      // ensure we don't return a partial result
+      if (openslide_get_error(osr)) {
+        memset(dest, 0, w * h * 4);
+      }
+      return;
+    }
+    // backend declined; dest is still cleared, fall through
+  }
+
+  read_region_chunks(osr, dest, x, y, level, w, 0, h);
+
+  // ensure we don't return a partial result
+  if (dest && openslide_get_error(osr)) {
+    memset(dest, 0, w * h * 4);
+  }
+}
+
+static int region_compare(const void *a, const void *b) {
+  const struct openslide_region *ra = *(struct openslide_region * const *) a;
+  const struct openslide_region *rb = *(struct openslide_region * const *) b;
+
+  // slide order: level, then top-to-bottom, then left-to-right
+  if (ra->level != rb->level) {
+    return ra->level < rb->level ? -1 : 1;
+  }
+  if (ra->y != rb->y) {
+    return ra->y < rb->y ? -1 : 1;
+  }
+  if (ra->x != rb->x) {
+    return ra->x < rb->x ? -1 : 1;
+  }
+  if (ra->w != rb->w) {
+    return ra->w < rb->w ? -1 : 1;
+  }
+  if (ra->h != rb->h) {
+    return ra->h < rb->h ? -1 : 1;
+  }
+  return 0;
+}
+
+void openslide_read_regions(openslide_t *osr,
+			    struct openslide_region *regions,
+			    int32_t count) {
+  if (regions == NULL || count <= 0) {
+    return;
+  }
+
+  // process in slide order.  within a level this matches the on-disk
+  // tile layout for all current backends, so the underlying file access
+  // is mostly sequential and neighboring requests hit the tile cache
+  struct openslide_region **sorted = g_new(struct openslide_region *, count);
+  for (int32_t i = 0; i < count; i++) {
+    sorted[i] = &regions[i];
+  }
+  qsort(sorted, count, sizeof *sorted, region_compare);
+
+  for (int32_t i = 0; i < count; i++) {
+    struct openslide_region *r = sorted[i];
+
+    // identical to the previous request?  copy instead of re-reading
+    if (i > 0 && region_compare(&sorted[i - 1], &r) == 0 &&
+        r->dest && sorted[i - 1]->dest &&
+        r->w > 0 && r->h > 0 &&
+        !openslide_get_error(osr)) {
+      memcpy(r->dest, sorted[i - 1]->dest, r->w * r->h * 4);
+      continue;
+    }
+
+    openslide_read_region(osr, r->dest, r->x, r->y, r->level, r->w, r->h);
+  }
+
+  g_free(sorted);
+}
+
+void openslide_read_region_downsampled(openslide_t *osr,
+				       uint32_t *dest,
+				       int64_t x, int64_t y,
+				       double downsample,
+				       int64_t w, int64_t h) {
+  if (!ensure_nonnegative_dimensions(osr, w, h)) {
+    return;
+  }
+
+  // clear the dest
+  if (dest) {
+    memset(dest, 0, w * h * 4);
+  }
+
+  if (openslide_get_error(osr)) {
+    return;
+  }
+  if (dest == NULL || w == 0 || h == 0 || downsample <= 0) {
+    return;
+  }
+
+  int32_t level = openslide_get_best_level_for_downsample(osr, downsample);
+  double level_ds = openslide_get_level_downsample(osr, level);
+  double factor = downsample / level_ds;
+
+  if (factor == 1.0) {
+    // the request falls exactly on a pyramid level
+    openslide_read_region(osr, dest, x, y, level, w, h);
+    return;
+  }
+
+  // total source size at the chosen level
+  int64_t src_w = MAX((int64_t) ceil(w * factor), 1);
+  int64_t src_h = MAX((int64_t) ceil(h * factor), 1);
+
+  // read in horizontal bands so only the final-size buffer plus a small
+  // band of source pixels is ever materialized
+  const int64_t max_band_pixels = 4 << 20;
+  int64_t dest_band_h = h;
+  while (dest_band_h > 1 &&
+         ((dest_band_h * src_h + h - 1) / h) * src_w > max_band_pixels) {
+    dest_band_h = (dest_band_h + 1) / 2;
+  }
+
+  int64_t max_band_rows = (dest_band_h * src_h + h - 1) / h + 1;
+  uint32_t *band = g_new(uint32_t, src_w * max_band_rows);
+
+  for (int64_t dy = 0; dy < h; dy += dest_band_h) {
+    int64_t dh = MIN(dest_band_h, h - dy);
+    int64_t sy0 = dy * src_h / h;
+    int64_t sy1 = MAX((dy + dh) * src_h / h, sy0 + 1);
+
+    int64_t sy = y + (int64_t) (sy0 * level_ds);
+    if ((double) (sy - y) == sy0 * level_ds) {
+      // the band start is exact in level 0 coordinates; take
+      // openslide_read_region's fast paths
+      openslide_read_region(osr, band, x, sy, level, src_w, sy1 - sy0);
+    } else {
+      // fractional downsample: the truncated coordinate is up to one
+      // pixel early, which would give each band a different sub-pixel
+      // phase than the scaler assumes; paint with exact compensation
+      memset(band, 0, src_w * (sy1 - sy0) * 4);
+      read_region_chunks(osr, band, x, y, level, src_w, sy0, sy1 - sy0);
+    }
+    if (openslide_get_error(osr)) {
+      break;
+    }
+
+    _openslide_pixelops_scale_argb(band, src_w, sy1 - sy0,
+				   dest + dy * w, w, dh);
+  }
+
+  g_free(band);
 
   // ensure we don't return a partial result
   if (openslide_get_error(osr)) {
@@ -634,6 +1336,67 @@ void openslide_read_region(openslide_t *osr,
   }
 }
 
+void openslide_read_region_stream(openslide_t *osr,
+				  openslide_read_region_stream_fn callback,
+				  void *arg,
+				  int64_t x, int64_t y,
+				  int32_t level,
+				  int64_t w, int64_t h) {
+  if (!ensure_nonnegative_dimensions(osr, w, h)) {
+    return;
+  }
+  if (callback == NULL || w == 0 || h == 0) {
+    return;
+  }
+
+  // band height: whole tile rows when the backend reports its tile
+  // size, sized so the band buffer stays modest
+  const int64_t max_band_pixels = 4 << 20;
+  int64_t tile_h = -1;
+  if (level_in_range(osr, level)) {
+    int64_t tile_w = -1;
+    (osr->ops->get_tile_geometry)(osr, level, &tile_w, &tile_h);
+  }
+  if (tile_h <= 0) {
+    tile_h = 256;
+  }
+  int64_t band_h = MAX(max_band_pixels / w, 1);
+  band_h -= band_h % tile_h;
+  band_h = CLAMP(band_h, tile_h, h);
+
+  uint32_t *band = g_new(uint32_t, w * band_h);
+  double ds = openslide_get_level_downsample(osr, level);
+
+  for (int64_t row = 0; row < h; row += band_h) {
+    int64_t bh = MIN(band_h, h - row);
+
+    // reads whole tile rows in slide order, so each tile is decoded
+    // once even though adjacent bands share no pixels
+    int64_t sy = y + (int64_t) (row * ds);
+    if ((double) (sy - y) == row * ds) {
+      // the band start is exact in level 0 coordinates; take
+      // openslide_read_region's fast paths
+      openslide_read_region(osr, band, x, sy, level, w, bh);
+    } else {
+      // fractional downsample: the truncated coordinate is up to one
+      // pixel early, which would give each band a different sub-pixel
+      // phase than a single openslide_read_region of the whole region;
+      // paint with exact compensation
+      memset(band, 0, w * bh * 4);
+      read_region_chunks(osr, band, x, y, level, w, row, bh);
+    }
+    if (openslide_get_error(osr)) {
+      break;
+    }
+
+    if (!callback(band, row, bh, arg)) {
+      break;
+    }
+  }
+
+  g_free(band);
+}
+
 
 void openslide_cairo_read_region(openslide_t *osr,
 				 cairo_t *cr,
@@ -667,6 +1430,13 @@ const char *openslide_get_property_value(openslide_t *osr, const char *name) {
     return NULL;
   }
 
+  // quickhash1 is computed on first access; serve it from the pending
+  // hash rather than mutating the property table under other readers
+  if (osr->quickhash1 != NULL &&
+      strcmp(name, OPENSLIDE_PROPERTY_NAME_QUICKHASH1) == 0) {
+    return _openslide_hash_get_string(osr->quickhash1);
+  }
+
   return g_hash_table_lookup(osr->properties, name);
 }
 
@@ -695,6 +1465,27 @@ void openslide_get_associated_image_dimensions(openslide_t *osr, const char *nam
   }
 }
 
+// protects the pinned pixels of all associated images
+static GStaticMutex associated_image_lock = G_STATIC_MUTEX_INIT;
+
+// decode the full-size pixels and pin them in the image struct.
+// returns NULL on failure.  call with associated_image_lock held
+static uint32_t *get_associated_image_data(openslide_t *osr,
+					   struct _openslide_associated_image *img) {
+  if (img->argb_data == NULL) {
+    uint32_t *buf = g_new(uint32_t, img->w * img->h);
+
+    img->get_argb_data(osr, img->ctx, buf, img->w, img->h);
+    if (openslide_get_error(osr)) {
+      g_free(buf);
+      return NULL;
+    }
+    img->argb_data = buf;
+  }
+
+  return img->argb_data;
+}
+
 void openslide_read_associated_image(openslide_t *osr,
 				     const char *name,
 				     uint32_t *dest) {
@@ -705,18 +1496,65 @@ void openslide_read_associated_image(openslide_t *osr,
   struct _openslide_associated_image *img = g_hash_table_lookup(osr->associated_images,
 								name);
   if (img) {
-    // this function is documented to do nothing on failure, so we need an
-    // extra memcpy
-    size_t pixels = img->w * img->h;
-    uint32_t *buf = g_new(uint32_t, pixels);
+    g_static_mutex_lock(&associated_image_lock);
 
-    img->get_argb_data(osr, img->ctx, buf, img->w, img->h);
-    if (dest && !openslide_get_error(osr)) {
-      memcpy(dest, buf, pixels * sizeof(uint32_t));
+    // this function is documented to do nothing on failure, so copy out
+    // of the pinned buffer
+    uint32_t *buf = get_associated_image_data(osr, img);
+    if (buf && dest) {
+      memcpy(dest, buf, img->w * img->h * sizeof(uint32_t));
     }
 
-    g_free(buf);
+    g_static_mutex_unlock(&associated_image_lock);
+  }
+}
+
+void openslide_read_associated_image_scaled(openslide_t *osr,
+					    const char *name,
+					    uint32_t *dest,
+					    int64_t w, int64_t h) {
+  if (openslide_get_error(osr)) {
+    return;
   }
+
+  struct _openslide_associated_image *img = g_hash_table_lookup(osr->associated_images,
+								name);
+  if (img == NULL || w <= 0 || h <= 0) {
+    return;
+  }
+
+  if (w == img->w && h == img->h) {
+    openslide_read_associated_image(osr, name, dest);
+    return;
+  }
+
+  g_static_mutex_lock(&associated_image_lock);
+
+  const uint32_t *src = img->argb_data;
+  int64_t src_w = img->w;
+  int64_t src_h = img->h;
+  uint32_t *tmp = NULL;
+
+  if (src == NULL) {
+    if (img->get_argb_data_scaled && w < img->w && h < img->h) {
+      // decode at reduced size; don't pin partial decodes
+      tmp = g_new(uint32_t, img->w * img->h);
+      img->get_argb_data_scaled(osr, img->ctx, tmp,
+				img->w, img->h,
+				w, h,
+				&src_w, &src_h);
+      src = tmp;
+    } else {
+      src = get_associated_image_data(osr, img);
+    }
+  }
+
+  if (src && dest && !openslide_get_error(osr)) {
+    _openslide_pixelops_scale_argb(src, src_w, src_h, dest, w, h);
+  }
+
+  g_free(tmp);
+  g_static_mutex_unlock(&associated_image_lock);
 }
 
 const char *openslide_get_version(void) {
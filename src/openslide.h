@@ -171,6 +171,125 @@ void openslide_read_region(openslide_t *osr,
 			   int64_t w, int64_t h);
 
 
+/**
+ * A single region request for openslide_read_regions().
+ */
+struct openslide_region {
+  /** The destination buffer for the ARGB data, or NULL to only warm
+      the cache. */
+  uint32_t *dest;
+  /** The top left x-coordinate, in the level 0 reference frame. */
+  int64_t x;
+  /** The top left y-coordinate, in the level 0 reference frame. */
+  int64_t y;
+  /** The desired level. */
+  int32_t level;
+  /** The width of the region. Must be non-negative. */
+  int64_t w;
+  /** The height of the region. Must be non-negative. */
+  int64_t h;
+};
+
+/**
+ * Copy pre-multiplied ARGB data for many regions at once.
+ *
+ * Each request behaves exactly like openslide_read_region(), but the
+ * batch is internally reordered to match the on-disk tile layout and
+ * duplicate requests are satisfied with a single read, which is
+ * substantially faster than issuing the calls one at a time when many
+ * small regions are read from the same slide.  The requests may be
+ * satisfied in any order.
+ *
+ * @param osr The OpenSlide object.
+ * @param regions An array of region requests.
+ * @param count The number of requests.
+ * @since 3.4.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_read_regions(openslide_t *osr,
+			    struct openslide_region *regions,
+			    int32_t count);
+
+
+/**
+ * Copy pre-multiplied ARGB data from a whole slide image at an
+ * arbitrary downsample factor.
+ *
+ * This function reads the region at the best pyramid level for
+ * @p downsample and scales it to exactly @p w by @p h pixels with a
+ * box/area filter, so callers need not allocate an intermediate
+ * full-resolution buffer or resample themselves.  @p dest must be a
+ * valid pointer to at least (@p w * @p h * 4) bytes.  If an error
+ * occurs or has occurred, then the memory pointed to by @p dest will
+ * be cleared.
+ *
+ * @param osr The OpenSlide object.
+ * @param dest The destination buffer for the ARGB data.
+ * @param x The top left x-coordinate, in the level 0 reference frame.
+ * @param y The top left y-coordinate, in the level 0 reference frame.
+ * @param downsample The desired downsample factor. Must be positive.
+ * @param w The width of the region after downsampling. Must be non-negative.
+ * @param h The height of the region after downsampling. Must be non-negative.
+ * @since 3.4.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_read_region_downsampled(openslide_t *osr,
+				       uint32_t *dest,
+				       int64_t x, int64_t y,
+				       double downsample,
+				       int64_t w, int64_t h);
+
+
+/**
+ * The callback invoked by openslide_read_region_stream() for each
+ * band of pixel data.
+ *
+ * @param band Pre-multiplied ARGB data for the band, @p w by @p h
+ *             pixels.  The buffer is reused for the next band, so the
+ *             callback must copy anything it wants to keep.
+ * @param y The row offset of the band within the requested region.
+ * @param h The number of rows in the band.
+ * @param arg The data argument passed to openslide_read_region_stream().
+ * @return true to continue, or false to stop reading.
+ * @since 3.4.0
+ */
+typedef bool (*openslide_read_region_stream_fn)(uint32_t *band,
+						int64_t y,
+						int64_t h,
+						void *arg);
+
+/**
+ * Read a region of a whole slide image in horizontal bands.
+ *
+ * This behaves like openslide_read_region(), except that instead of
+ * filling one buffer of (@p w * @p h * 4) bytes, the region is
+ * delivered top to bottom as a series of bands through @p callback,
+ * and a single internal band buffer is reused throughout.  Peak
+ * memory is proportional to the region width rather than its area,
+ * so arbitrarily tall regions can be extracted.  Bands are whole
+ * tile rows when the backend reports its tile size.  If an error
+ * occurs, reading stops; the callback may have already been invoked
+ * with earlier bands.
+ *
+ * @param osr The OpenSlide object.
+ * @param callback The function to invoke for each band.
+ * @param arg Data to pass to the callback.
+ * @param x The top left x-coordinate, in the level 0 reference frame.
+ * @param y The top left y-coordinate, in the level 0 reference frame.
+ * @param level The desired level.
+ * @param w The width of the region. Must be non-negative.
+ * @param h The height of the region. Must be non-negative.
+ * @since 3.4.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_read_region_stream(openslide_t *osr,
+				  openslide_read_region_stream_fn callback,
+				  void *arg,
+				  int64_t x, int64_t y,
+				  int32_t level,
+				  int64_t w, int64_t h);
+
+
 /**
  * Close an OpenSlide object.
  * No other threads may be using the object.
@@ -182,6 +301,187 @@ OPENSLIDE_PUBLIC()
 void openslide_close(openslide_t *osr);
 //@}
 
+/**
+ * @name Cache Configuration
+ * Sizing the in-memory tile cache.
+ *
+ * Each OpenSlide object keeps a cache of decoded tiles, bounded by a
+ * byte budget.  Applications that keep many slides open, or that know
+ * their access pattern, can tune the budget instead of relying on the
+ * built-in default.
+ */
+//@{
+
+/**
+ * Set the tile cache capacity of an OpenSlide object.
+ *
+ * Lowering the capacity evicts tiles immediately.  A capacity of 0
+ * disables caching.  Capacities beyond an implementation-defined limit
+ * are clamped.
+ *
+ * @param osr The OpenSlide object.
+ * @param capacity The new capacity, in bytes. Must be non-negative.
+ * @since 3.4.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_set_cache_size(openslide_t *osr, int64_t capacity);
+
+/**
+ * Get the tile cache capacity of an OpenSlide object.
+ *
+ * @param osr The OpenSlide object.
+ * @return The capacity in bytes, or -1 if an error occurred.
+ * @since 3.4.0
+ */
+OPENSLIDE_PUBLIC()
+int64_t openslide_get_cache_size(openslide_t *osr);
+
+/**
+ * Set the default tile cache capacity for subsequently-opened slides.
+ *
+ * This allows sizing cache memory to the machine rather than to a
+ * per-slide compile-time constant.  Slides that are already open are
+ * not affected; use openslide_set_cache_size() for those.
+ *
+ * @param capacity The new default capacity, in bytes. Must be
+ *                 non-negative.
+ * @since 3.4.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_set_default_cache_size(int64_t capacity);
+
+/**
+ * Share one tile cache among subsequently-opened slides.
+ *
+ * By default every slide has its own cache, so a process with many
+ * open slides must provision cache memory per slide.  After this call,
+ * slides opened later attach to a single process-wide cache with the
+ * given byte budget; eviction then balances across all attached
+ * slides, so idle slides naturally give up their tiles to busy ones.
+ *
+ * openslide_set_cache_size() on an attached slide adjusts the shared
+ * budget.  Pass a capacity of 0 to return to per-slide caches for
+ * slides opened later; slides already attached remain attached until
+ * closed.
+ *
+ * @param capacity The shared cache capacity, in bytes. Must be
+ *                 non-negative.
+ * @since 3.4.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_set_shared_cache_size(int64_t capacity);
+
+//@}
+
+/**
+ * @name I/O Providers
+ * Reading slides from storage other than local files.
+ *
+ * By default all file access goes through stdio.  An application can
+ * instead register an I/O provider, after which every file OpenSlide
+ * opens -- the slide itself and any files it references -- is read
+ * through the provider's callbacks.  Provider reads are cached and
+ * issued as large aligned blocks with readahead, so a provider backed
+ * by high-latency storage such as an object store sees a small number
+ * of sizeable requests rather than libtiff- and libjpeg-sized ones.
+ */
+//@{
+
+/**
+ * An I/O provider.  All callbacks are required.  The provider must
+ * support concurrent calls on different files; calls on one file are
+ * serialized by the library.
+ *
+ * @since 3.4.0
+ */
+struct openslide_io_provider {
+  /** Open the named file read-only.  Returns an opaque file handle,
+      or NULL on failure. */
+  void *(*open)(const char *filename, void *provider_data);
+  /** Read up to @p count bytes at @p offset.  Returns the number of
+      bytes read, 0 at end of file, or -1 on failure. */
+  int64_t (*pread)(void *file, void *buf, int64_t count, int64_t offset);
+  /** Return the size of the file in bytes, or -1 on failure. */
+  int64_t (*size)(void *file);
+  /** Close the file handle. */
+  void (*close)(void *file);
+};
+
+/**
+ * Register a process-wide I/O provider.
+ *
+ * Must be called before any slides are opened and cannot be changed
+ * while slides are open.  Pass NULL to restore direct stdio access.
+ * Not supported on platforms without fopencookie(); there the call is
+ * ignored with a warning.
+ *
+ * @param provider The provider, which must remain valid until replaced.
+ * @param provider_data Data passed to the provider's open callback.
+ * @since 3.4.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_set_io_provider(const struct openslide_io_provider *provider,
+			       void *provider_data);
+
+//@}
+
+/**
+ * @name Statistics
+ * Runtime performance counters.
+ *
+ * Counters are maintained per OpenSlide object with no synchronization,
+ * so values read while another thread is painting may be slightly
+ * stale.  They are intended for diagnosing slow slides, not for exact
+ * accounting.
+ */
+//@{
+
+/**
+ * The number of tile reads satisfied from the tile cache.
+ */
+#define OPENSLIDE_STAT_NAME_CACHE_HITS "openslide.stats.cache-hits"
+
+/**
+ * The number of tile reads that required a decode.
+ */
+#define OPENSLIDE_STAT_NAME_CACHE_MISSES "openslide.stats.cache-misses"
+
+/**
+ * The number of tiles decoded.
+ */
+#define OPENSLIDE_STAT_NAME_TILES_DECODED "openslide.stats.tiles-decoded"
+
+/**
+ * The number of pixel bytes produced by tile decodes.
+ */
+#define OPENSLIDE_STAT_NAME_BYTES_DECODED "openslide.stats.bytes-decoded"
+
+/**
+ * Get the NULL-terminated array of statistic names.
+ *
+ * @param osr The OpenSlide object.
+ * @return A NULL-terminated string array of statistic names, or an
+ *         empty array if an error occurred.
+ * @since 3.4.0
+ */
+OPENSLIDE_PUBLIC()
+const char * const *openslide_get_stat_names(openslide_t *osr);
+
+/**
+ * Get the current value of a statistic.
+ *
+ * @param osr The OpenSlide object.
+ * @param name The name of the desired statistic. Must be a valid name
+ *             as given by openslide_get_stat_names().
+ * @return The value of the named statistic, or -1 if the statistic
+ *         doesn't exist or an error occurred.
+ * @since 3.4.0
+ */
+OPENSLIDE_PUBLIC()
+int64_t openslide_get_stat(openslide_t *osr, const char *name);
+
+//@}
+
 /**
  * @name Error Handling
  * A simple mechanism for detecting errors.
@@ -382,6 +682,31 @@ OPENSLIDE_PUBLIC()
 void openslide_read_associated_image(openslide_t *osr,
 				     const char *name,
 				     uint32_t *dest);
+
+/**
+ * Copy pre-multiplied ARGB data from an associated image, scaled to the
+ * requested size.
+ *
+ * This function works like openslide_read_associated_image(), except
+ * that the image is scaled to exactly @p w by @p h pixels.  @p dest
+ * must be a valid pointer to at least (@p w * @p h * 4) bytes.  When
+ * the image is stored as JPEG and the requested size is smaller than
+ * the full image, the decode itself is performed at reduced scale.
+ * This call does nothing if an error occurred.
+ *
+ * @param osr The OpenSlide object.
+ * @param name The name of the desired associated image. Must be
+ *             a valid name as given by openslide_get_associated_image_names().
+ * @param dest The destination buffer for the ARGB data.
+ * @param w The width of the destination buffer.
+ * @param h The height of the destination buffer.
+ * @since 3.4.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_read_associated_image_scaled(openslide_t *osr,
+					    const char *name,
+					    uint32_t *dest,
+					    int64_t w, int64_t h);
 //@}
 
 /**
@@ -401,6 +726,55 @@ const char *openslide_get_version(void);
 
 //@}
 
+/**
+ * @name Prefetching
+ * Warming the tile cache in the background.
+ */
+//@{
+
+/**
+ * Hint that a region will be read soon.
+ *
+ * A background thread will decode the tiles for the given region into
+ * the tile cache, so that a subsequent openslide_read_region() call
+ * for it is mostly cache hits.  Prefetching is advisory; the hinted
+ * tiles may be evicted again before they are used.  The hint should be
+ * cancelled with openslide_cancel_prefetch_hint() once the region has
+ * been read or is no longer interesting.
+ *
+ * @param osr The OpenSlide object.
+ * @param x The top left x-coordinate, in the level 0 reference frame.
+ * @param y The top left y-coordinate, in the level 0 reference frame.
+ * @param level The desired level.
+ * @param w The width of the region.
+ * @param h The height of the region.
+ * @return An identifier for this prefetch hint, or 0 if an error
+ *         occurred or the arguments were out of range.
+ * @since 3.4.0
+ */
+OPENSLIDE_PUBLIC()
+int openslide_give_prefetch_hint(openslide_t *osr,
+				 int64_t x, int64_t y,
+				 int32_t level,
+				 int64_t w, int64_t h);
+
+/**
+ * Cancel a prefetch hint.
+ *
+ * If the prefetch is still running, it is stopped as soon as possible.
+ * Tiles already decoded remain in the cache.  Cancelling a hint that
+ * has already completed is allowed and does nothing.
+ *
+ * @param osr The OpenSlide object.
+ * @param prefetch_id An identifier returned by
+ *                    openslide_give_prefetch_hint().
+ * @since 3.4.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_cancel_prefetch_hint(openslide_t *osr, int prefetch_id);
+
+//@}
+
 /**
  * @name Deprecated Functions
  * Functions that will be removed in the next major release.
@@ -495,15 +869,6 @@ const char *openslide_get_comment(openslide_t *osr);
 
 //@}
 
-// these are meant to throw compile- and link-time errors,
-// since the functions they replace were never implemented
-int _openslide_give_prefetch_hint_UNIMPLEMENTED(void);
-void _openslide_cancel_prefetch_hint_UNIMPLEMENTED(void);
-#define openslide_give_prefetch_hint(osr, x, y, level, w, h)	\
-  _openslide_give_prefetch_hint_UNIMPLEMENTED(-1);
-#define openslide_cancel_prefetch_hint(osr, prefetch_id)	\
-  _openslide_cancel_prefetch_hint_UNIMPLEMENTED(-1)
-
 /**
  * @mainpage OpenSlide
  *
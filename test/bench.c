@@ -0,0 +1,296 @@
+/*
+ *  OpenSlide, a library for reading whole slide image files
+ *
+ *  Copyright (c) 2013 Carnegie Mellon University
+ *  All rights reserved.
+ *
+ *  OpenSlide is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, version 2.1.
+ *
+ *  OpenSlide is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with OpenSlide. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Tile-throughput benchmark.  For each slide and each thread count,
+   read regions either as a sequential scan of a level or as random
+   viewports, and report tiles/sec, p50/p99 latency, and bytes painted.
+   Slides come from the command line or from a manifest file, so runs
+   are comparable between OpenSlide versions. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <glib.h>
+#include <openslide.h>
+
+static int opt_tile_size = 512;
+static int opt_level = 0;
+static int opt_random = 0;
+static int opt_seed = 42;
+static char *opt_threads = NULL;
+static gint64 opt_cache_size = -1;
+static char *opt_manifest = NULL;
+
+static GOptionEntry options[] = {
+  {"threads", 't', 0, G_OPTION_ARG_STRING, &opt_threads,
+   "Comma-separated thread counts to sweep (default \"1,2,4,8\")", "LIST"},
+  {"tile-size", 's', 0, G_OPTION_ARG_INT, &opt_tile_size,
+   "Region size in pixels (default 512)", "PIXELS"},
+  {"level", 'l', 0, G_OPTION_ARG_INT, &opt_level,
+   "Level to read (default 0)", "LEVEL"},
+  {"random", 'r', 0, G_OPTION_ARG_INT, &opt_random,
+   "Read COUNT random viewports instead of scanning", "COUNT"},
+  {"seed", 0, 0, G_OPTION_ARG_INT, &opt_seed,
+   "Seed for the random access pattern (default 42)", "SEED"},
+  {"cache-size", 'c', 0, G_OPTION_ARG_INT64, &opt_cache_size,
+   "Tile cache capacity in bytes (default: library default)", "BYTES"},
+  {"manifest", 'm', 0, G_OPTION_ARG_FILENAME, &opt_manifest,
+   "File listing slides to benchmark, one per line", "FILE"},
+  {NULL, 0, 0, 0, NULL, NULL, NULL}
+};
+
+struct state {
+  openslide_t *osr;
+  GAsyncQueue *jobs;
+  GAsyncQueue *completions;
+};
+
+struct job {
+  int64_t x;
+  int64_t y;
+  double latency;
+};
+
+static struct job sentinel;
+
+static void *thread_func(void *data) {
+  struct state *state = data;
+  struct job *job;
+  uint32_t bufsz = opt_tile_size * opt_tile_size * sizeof(uint32_t);
+  uint32_t *buf = g_slice_alloc(bufsz);
+  GTimer *timer = g_timer_new();
+
+  g_async_queue_push(state->completions, &sentinel);
+  while (1) {
+    job = g_async_queue_pop(state->jobs);
+    if (job == &sentinel) {
+      break;
+    }
+    double start = g_timer_elapsed(timer, NULL);
+    openslide_read_region(state->osr, buf, job->x, job->y, opt_level,
+                          opt_tile_size, opt_tile_size);
+    job->latency = g_timer_elapsed(timer, NULL) - start;
+    g_async_queue_push(state->completions, job);
+  }
+  g_async_queue_push(state->completions, &sentinel);
+  g_timer_destroy(timer);
+  g_slice_free1(bufsz, buf);
+  return NULL;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+  double da = *(const double *) a;
+  double db = *(const double *) b;
+  return (da > db) - (da < db);
+}
+
+static double percentile(GArray *latencies, double p) {
+  if (latencies->len == 0) {
+    return 0;
+  }
+  return g_array_index(latencies, double,
+                       (guint) ((latencies->len - 1) * p));
+}
+
+// returns false on slide error
+static bool run_one(const char *file, int threads) {
+  struct state state;
+
+  state.osr = openslide_open(file);
+  if (!state.osr) {
+    fprintf(stderr, "%s: unrecognized file\n", file);
+    return false;
+  }
+  const char *error = openslide_get_error(state.osr);
+  if (error) {
+    fprintf(stderr, "%s: %s\n", file, error);
+    openslide_close(state.osr);
+    return false;
+  }
+  if (opt_cache_size >= 0) {
+    openslide_set_cache_size(state.osr, opt_cache_size);
+  }
+
+  int64_t w, h;
+  openslide_get_level_dimensions(state.osr, opt_level, &w, &h);
+  if (w <= 0 || h <= 0) {
+    fprintf(stderr, "%s: no such level %d\n", file, opt_level);
+    openslide_close(state.osr);
+    return false;
+  }
+  double ds = openslide_get_level_downsample(state.osr, opt_level);
+
+  // start threads
+  state.jobs = g_async_queue_new();
+  state.completions = g_async_queue_new();
+  for (int i = 0; i < threads; i++) {
+    if (g_thread_create(thread_func, &state, FALSE, NULL) == NULL) {
+      fprintf(stderr, "Couldn't start thread\n");
+      exit(1);
+    }
+  }
+  for (int i = 0; i < threads; i++) {
+    g_async_queue_pop(state.completions);
+  }
+
+  GRand *rand = g_rand_new_with_seed(opt_seed);
+  GArray *latencies = g_array_new(FALSE, FALSE, sizeof(double));
+  int64_t tiles = 0;
+  struct job *job;
+  int priming = 5 * threads;
+  GTimer *timer = g_timer_new();
+
+  // enqueue jobs; coordinates are in the level 0 plane
+  int64_t step = opt_tile_size * ds;
+  int64_t count = opt_random ? opt_random :
+      ((w + opt_tile_size - 1) / opt_tile_size) *
+      ((h + opt_tile_size - 1) / opt_tile_size);
+  int64_t tiles_across = (w + opt_tile_size - 1) / opt_tile_size;
+  for (int64_t i = 0; i < count; i++) {
+    if (priming) {
+      job = g_slice_new(struct job);
+      priming--;
+    } else {
+      job = g_async_queue_pop(state.completions);
+      g_array_append_val(latencies, job->latency);
+    }
+    if (opt_random) {
+      job->x = (int64_t) (g_rand_double(rand) * (w - opt_tile_size)) * ds;
+      job->y = (int64_t) (g_rand_double(rand) * (h - opt_tile_size)) * ds;
+    } else {
+      job->x = (i % tiles_across) * step;
+      job->y = (i / tiles_across) * step;
+    }
+    g_async_queue_push(state.jobs, job);
+    tiles++;
+  }
+
+  // tell threads to stop, then drain
+  for (int i = 0; i < threads; i++) {
+    g_async_queue_push(state.jobs, &sentinel);
+  }
+  int running = threads;
+  while (running > 0) {
+    job = g_async_queue_pop(state.completions);
+    if (job == &sentinel) {
+      running--;
+    } else {
+      g_array_append_val(latencies, job->latency);
+      g_slice_free(struct job, job);
+    }
+  }
+  double seconds = g_timer_elapsed(timer, NULL);
+
+  bool ok = true;
+  error = openslide_get_error(state.osr);
+  if (error) {
+    fprintf(stderr, "%s: %s\n", file, error);
+    ok = false;
+  } else {
+    qsort(latencies->data, latencies->len, sizeof(double), compare_doubles);
+    printf("%s\tthreads %d\t%s %" G_GINT64_FORMAT " tiles\t"
+           "%.1f tiles/sec\tp50 %.2f ms\tp99 %.2f ms\t%.1f MB\n",
+           file, threads,
+           opt_random ? "random" : "scan",
+           tiles,
+           tiles / seconds,
+           percentile(latencies, 0.50) * 1000,
+           percentile(latencies, 0.99) * 1000,
+           tiles * opt_tile_size * (double) opt_tile_size * 4 / 1e6);
+  }
+
+  openslide_close(state.osr);
+  g_timer_destroy(timer);
+  g_rand_free(rand);
+  g_array_free(latencies, TRUE);
+  g_async_queue_unref(state.jobs);
+  g_async_queue_unref(state.completions);
+  return ok;
+}
+
+int main(int argc, char **argv) {
+  GError *err = NULL;
+
+  GOptionContext *ctx =
+    g_option_context_new("[SLIDE...] - benchmark tile throughput");
+  g_option_context_add_main_entries(ctx, options, NULL);
+  if (!g_option_context_parse(ctx, &argc, &argv, &err)) {
+    fprintf(stderr, "%s\n", err->message);
+    return 2;
+  }
+  g_option_context_free(ctx);
+
+  // gather slides
+  GPtrArray *slides = g_ptr_array_new();
+  for (int i = 1; i < argc; i++) {
+    g_ptr_array_add(slides, g_strdup(argv[i]));
+  }
+  if (opt_manifest) {
+    char *contents;
+    if (!g_file_get_contents(opt_manifest, &contents, NULL, &err)) {
+      fprintf(stderr, "%s\n", err->message);
+      return 2;
+    }
+    char **lines = g_strsplit(contents, "\n", 0);
+    for (char **line = lines; *line; line++) {
+      g_strstrip(*line);
+      if ((*line)[0] && (*line)[0] != '#') {
+        g_ptr_array_add(slides, g_strdup(*line));
+      }
+    }
+    g_strfreev(lines);
+    g_free(contents);
+  }
+  if (slides->len == 0) {
+    fprintf(stderr, "No slides given; pass files or --manifest\n");
+    return 2;
+  }
+
+  // parse thread counts
+  GArray *threads = g_array_new(FALSE, FALSE, sizeof(int));
+  char **counts = g_strsplit(opt_threads ? opt_threads : "1,2,4,8", ",", 0);
+  for (char **count = counts; *count; count++) {
+    int n = atoi(*count);
+    if (n < 1) {
+      fprintf(stderr, "Invalid thread count\n");
+      return 2;
+    }
+    g_array_append_val(threads, n);
+  }
+  g_strfreev(counts);
+
+  int failures = 0;
+  for (guint i = 0; i < slides->len; i++) {
+    for (guint j = 0; j < threads->len; j++) {
+      if (!run_one(g_ptr_array_index(slides, i),
+                   g_array_index(threads, int, j))) {
+        failures++;
+        break;  // don't retry a broken slide at other thread counts
+      }
+    }
+  }
+
+  g_array_free(threads, TRUE);
+  g_ptr_array_free(slides, TRUE);
+  return failures ? 1 : 0;
+}
@@ -19,17 +19,119 @@
  *
  */
 
+#include <string.h>
 #include <glib.h>
+#include <glib/gstdio.h>
 #include "openslide.h"
 #include "openslide-tools-common.h"
 
-static gboolean process(const char *file) {
+static int jobs = 1;
+static char *manifest_path;
+
+static const GOptionEntry tool_options[] = {
+  {"jobs", 'j', 0, G_OPTION_ARG_INT, &jobs,
+   "Hash N slides in parallel", "N"},
+  {"manifest", 0, 0, G_OPTION_ARG_FILENAME, &manifest_path,
+   "Reuse hashes from FILE for slides whose mtime is unchanged, "
+   "and rewrite it with this run's results", "FILE"},
+  {NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL}
+};
+
+// one slide to hash; results are collected here so output can be
+// printed in argument order regardless of which worker finishes first
+struct task {
+  const char *file;
+  int64_t mtime;  // -1 if the file couldn't be statted
+  char *hash;     // NULL until hashed; stays NULL on failure
+};
+
+// manifest line: "<hash> <mtime> <path>"
+struct manifest_entry {
+  char *hash;
+  int64_t mtime;
+};
+
+static void manifest_entry_free(gpointer data) {
+  struct manifest_entry *e = data;
+  g_free(e->hash);
+  g_slice_free(struct manifest_entry, e);
+}
+
+static int64_t get_mtime(const char *file) {
+  GStatBuf st;
+  if (g_stat(file, &st)) {
+    return -1;
+  }
+  return st.st_mtime;
+}
+
+static GHashTable *load_manifest(const char *path) {
+  GHashTable *ht = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                         g_free, manifest_entry_free);
+
+  // a missing manifest just means everything gets hashed
+  FILE *f = fopen(path, "r");
+  if (f == NULL) {
+    return ht;
+  }
+
+  char line[4096];
+  while (fgets(line, sizeof line, f) != NULL) {
+    g_strchomp(line);
+
+    char *mtime_field = strchr(line, ' ');
+    if (mtime_field == NULL) {
+      continue;
+    }
+    *mtime_field++ = 0;
+    char *path_field = strchr(mtime_field, ' ');
+    if (path_field == NULL) {
+      continue;
+    }
+    *path_field++ = 0;
+
+    struct manifest_entry *e = g_slice_new(struct manifest_entry);
+    e->hash = g_strdup(line);
+    e->mtime = g_ascii_strtoll(mtime_field, NULL, 10);
+    g_hash_table_replace(ht, g_strdup(path_field), e);
+  }
+  fclose(f);
+  return ht;
+}
+
+static gboolean write_manifest(const char *path,
+                               struct task *tasks, int count) {
+  FILE *f = fopen(path, "w");
+  if (f == NULL) {
+    fprintf(stderr, "%s: %s: Couldn't write manifest\n",
+            g_get_prgname(), path);
+    fflush(stderr);
+    return FALSE;
+  }
+
+  for (int i = 0; i < count; i++) {
+    if (tasks[i].hash != NULL && tasks[i].mtime != -1) {
+      fprintf(f, "%s %" G_GINT64_FORMAT " %s\n",
+              tasks[i].hash, tasks[i].mtime, tasks[i].file);
+    }
+  }
+
+  if (fclose(f)) {
+    fprintf(stderr, "%s: %s: Couldn't write manifest\n",
+            g_get_prgname(), path);
+    fflush(stderr);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+static char *compute_hash(const char *file) {
   openslide_t *osr = openslide_open(file);
   if (osr == NULL) {
     fprintf(stderr, "%s: %s: Not a file that OpenSlide can recognize\n",
 	    g_get_prgname(), file);
     fflush(stderr);
-    return FALSE;
+    return NULL;
   }
 
   const char *err = openslide_get_error(osr);
@@ -37,29 +139,32 @@ static gboolean process(const char *file) {
     fprintf(stderr, "%s: %s: %s\n", g_get_prgname(), file, err);
     fflush(stderr);
     openslide_close(osr);
-    return FALSE;
+    return NULL;
   }
 
   const char *hash = openslide_get_property_value(osr,
         "openslide.quickhash-1");
-  if (hash != NULL) {
-    printf("%s  %s\n", hash, file);
-  } else {
+  char *result = g_strdup(hash);
+  if (result == NULL) {
     fprintf(stderr, "%s: %s: No quickhash-1 available\n", g_get_prgname(),
             file);
     fflush(stderr);
-    openslide_close(osr);
-    return FALSE;
   }
 
   openslide_close(osr);
-  return TRUE;
+  return result;
+}
+
+static void hash_task(gpointer data, gpointer user_data G_GNUC_UNUSED) {
+  struct task *t = data;
+  t->hash = compute_hash(t->file);
 }
 
 
 static const struct openslide_tools_usage_info usage_info = {
   "FILE...",
   "Print OpenSlide quickhash-1 (256-bit) checksums.",
+  tool_options,
 };
 
 int main (int argc, char **argv) {
@@ -67,13 +172,67 @@ int main (int argc, char **argv) {
   if (argc < 2) {
     _openslide_tools_usage(&usage_info);
   }
+  jobs = MAX(jobs, 1);
+
+  GHashTable *manifest = NULL;
+  if (manifest_path != NULL) {
+    manifest = load_manifest(manifest_path);
+  }
+
+  int count = argc - 1;
+  struct task *tasks = g_new0(struct task, count);
+  for (int i = 0; i < count; i++) {
+    tasks[i].file = argv[i + 1];
+    tasks[i].mtime = get_mtime(tasks[i].file);
+
+    // unchanged since the last run?  reuse the recorded hash
+    if (manifest != NULL && tasks[i].mtime != -1) {
+      struct manifest_entry *e = g_hash_table_lookup(manifest,
+                                                     tasks[i].file);
+      if (e != NULL && e->mtime == tasks[i].mtime) {
+        tasks[i].hash = g_strdup(e->hash);
+      }
+    }
+  }
+
+  if (jobs > 1) {
+    GThreadPool *pool = g_thread_pool_new(hash_task, NULL, jobs,
+                                          FALSE, NULL);
+    for (int i = 0; i < count; i++) {
+      if (tasks[i].hash == NULL) {
+        g_thread_pool_push(pool, &tasks[i], NULL);
+      }
+    }
+    // wait for everything to finish
+    g_thread_pool_free(pool, FALSE, TRUE);
+  } else {
+    for (int i = 0; i < count; i++) {
+      if (tasks[i].hash == NULL) {
+        hash_task(&tasks[i], NULL);
+      }
+    }
+  }
 
   int ret = 0;
-  for (int i = 1; i < argc; i++) {
-    if (!process(argv[i])) {
+  for (int i = 0; i < count; i++) {
+    if (tasks[i].hash != NULL) {
+      printf("%s  %s\n", tasks[i].hash, tasks[i].file);
+    } else {
       ret = 1;
     }
   }
 
+  if (manifest_path != NULL) {
+    if (!write_manifest(manifest_path, tasks, count)) {
+      ret = 1;
+    }
+    g_hash_table_destroy(manifest);
+  }
+
+  for (int i = 0; i < count; i++) {
+    g_free(tasks[i].hash);
+  }
+  g_free(tasks);
+
   return ret;
 }
@@ -27,6 +27,7 @@
 struct openslide_tools_usage_info {
   const char *parameter_string;
   const char *summary;
+  const GOptionEntry *extra_options;  // may be NULL
 };
 
 void _openslide_tools_parse_commandline(const struct openslide_tools_usage_info *info,
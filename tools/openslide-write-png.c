@@ -175,6 +175,7 @@ static void write_png(openslide_t *osr, FILE *f,
 static const struct openslide_tools_usage_info usage_info = {
   "slide x y level width height output.png",
   "Write a region of a virtual slide to a PNG.",
+  NULL,
 };
 
 int main (int argc, char **argv) {
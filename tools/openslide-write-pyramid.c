@@ -0,0 +1,372 @@
+/*
+ *  OpenSlide, a library for reading whole slide image files
+ *
+ *  Copyright (c) 2007-2013 Carnegie Mellon University
+ *  All rights reserved.
+ *
+ *  OpenSlide is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, version 2.1.
+ *
+ *  OpenSlide is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with OpenSlide. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "openslide.h"
+#include "openslide-tools-common.h"
+
+#include <png.h>
+#include <inttypes.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <setjmp.h>
+#include <stdint.h>
+
+static const char SOFTWARE[] = "Software";
+static const char OPENSLIDE[] = "OpenSlide <http://openslide.org/>";
+
+#define DEFAULT_THREADS 4
+
+#define ENSURE_POS(i) \
+  if (i <= 0) {					\
+    fail(#i " must be positive");	\
+  }
+
+static void fail(const char *format, ...) {
+  va_list ap;
+
+  va_start(ap, format);
+  char *msg = g_strdup_vprintf(format, ap);
+  va_end(ap);
+
+  fprintf(stderr, "%s: %s\n", g_get_prgname(), msg);
+  fflush(stderr);
+
+  exit(1);
+}
+
+// a tile waiting to be compressed and written
+struct tile_job {
+  char *path;
+  uint32_t *argb;  // owned; w * h pixels
+  int32_t w;
+  int32_t h;
+};
+
+// throttle so the compression pool can't queue unbounded pixel data
+struct pool_limiter {
+  GMutex *mutex;
+  GCond *cond;
+  int pending;
+  int max_pending;
+};
+
+static struct pool_limiter limiter;
+
+static void unpremultiply_row(uint32_t *row, int32_t w) {
+  for (int32_t i = 0; i < w; i++) {
+    uint32_t p = row[i];
+    uint8_t *p8 = (uint8_t *) (row + i);
+
+    uint8_t a = (p >> 24) & 0xFF;
+    uint8_t r = (p >> 16) & 0xFF;
+    uint8_t g = (p >> 8) & 0xFF;
+    uint8_t b = p & 0xFF;
+
+    switch (a) {
+    case 0:
+      r = 0;
+      b = 0;
+      g = 0;
+      break;
+
+    case 255:
+      // no action
+      break;
+
+    default:
+      r = (r * 255 + a / 2) / a;
+      g = (g * 255 + a / 2) / a;
+      b = (b * 255 + a / 2) / a;
+      break;
+    }
+
+    // write back
+    p8[0] = r;
+    p8[1] = g;
+    p8[2] = b;
+    p8[3] = a;
+  }
+}
+
+static void write_tile_png(const char *path, uint32_t *argb,
+			   int32_t w, int32_t h) {
+  FILE *f = fopen(path, "wb");
+  if (!f) {
+    fail("Can't open %s for writing: %s", path, strerror(errno));
+  }
+
+  png_structp png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING,
+						NULL, NULL, NULL);
+  if (!png_ptr) {
+    fail("Could not initialize PNG");
+  }
+
+  png_infop info_ptr = png_create_info_struct(png_ptr);
+  if (!info_ptr) {
+    fail("Could not initialize PNG");
+  }
+
+  if (setjmp(png_jmpbuf(png_ptr))) {
+    fail("Error writing %s", path);
+  }
+
+  png_init_io(png_ptr, f);
+
+  png_set_IHDR(png_ptr, info_ptr, w, h, 8,
+	       PNG_COLOR_TYPE_RGB_ALPHA, PNG_INTERLACE_NONE,
+	       PNG_COMPRESSION_TYPE_DEFAULT,
+	       PNG_FILTER_TYPE_DEFAULT);
+
+  // text
+  png_text text_ptr[1];
+  memset(text_ptr, 0, sizeof text_ptr);
+  text_ptr[0].compression = PNG_TEXT_COMPRESSION_NONE;
+  char *key = strdup(SOFTWARE);
+  text_ptr[0].key = key;
+  char *text = strdup(OPENSLIDE);
+  text_ptr[0].text = text;
+  text_ptr[0].text_length = strlen(text);
+
+  png_set_text(png_ptr, info_ptr, text_ptr, 1);
+
+  png_write_info(png_ptr, info_ptr);
+
+  for (int32_t row = 0; row < h; row++) {
+    unpremultiply_row(argb + (int64_t) row * w, w);
+    png_write_row(png_ptr, (png_bytep) (argb + (int64_t) row * w));
+  }
+
+  png_write_end(png_ptr, info_ptr);
+  png_destroy_write_struct(&png_ptr, &info_ptr);
+  g_free(key);
+  g_free(text);
+  fclose(f);
+}
+
+static void compress_tile(gpointer data, gpointer user_data G_GNUC_UNUSED) {
+  struct tile_job *job = data;
+
+  write_tile_png(job->path, job->argb, job->w, job->h);
+
+  g_free(job->argb);
+  g_free(job->path);
+  g_slice_free(struct tile_job, job);
+
+  g_mutex_lock(limiter.mutex);
+  limiter.pending--;
+  g_cond_signal(limiter.cond);
+  g_mutex_unlock(limiter.mutex);
+}
+
+static void push_tile(GThreadPool *pool, struct tile_job *job) {
+  g_mutex_lock(limiter.mutex);
+  while (limiter.pending >= limiter.max_pending) {
+    g_cond_wait(limiter.cond, limiter.mutex);
+  }
+  limiter.pending++;
+  g_mutex_unlock(limiter.mutex);
+
+  g_thread_pool_push(pool, job, NULL);
+}
+
+static void wait_for_pool(void) {
+  g_mutex_lock(limiter.mutex);
+  while (limiter.pending > 0) {
+    g_cond_wait(limiter.cond, limiter.mutex);
+  }
+  g_mutex_unlock(limiter.mutex);
+}
+
+// state for one level: the bands streamed out of the library are
+// accumulated into a full-width buffer one tile row tall, and a
+// finished tile row is split into tiles for the compression pool
+struct level_state {
+  GThreadPool *pool;
+  const char *leveldir;
+  int32_t tile_size;
+  int64_t w;
+  int64_t h;
+  uint32_t *rowbuf;  // w * tile_size pixels
+  int64_t filled;    // rows currently in rowbuf
+  int64_t ty;        // tile row being filled
+};
+
+static void flush_tile_row(struct level_state *ls) {
+  int64_t tiles_across = (ls->w + ls->tile_size - 1) / ls->tile_size;
+  int32_t th = ls->filled;
+
+  for (int64_t tx = 0; tx < tiles_across; tx++) {
+    int32_t tw = MIN(ls->tile_size, ls->w - tx * ls->tile_size);
+    int64_t x_in_row = tx * ls->tile_size;
+
+    struct tile_job *job = g_slice_new(struct tile_job);
+    job->path = g_strdup_printf("%s/%" G_GINT64_FORMAT
+				"_%" G_GINT64_FORMAT ".png",
+				ls->leveldir, tx, ls->ty);
+    job->w = tw;
+    job->h = th;
+    job->argb = g_malloc((int64_t) tw * th * 4);
+    for (int32_t row = 0; row < th; row++) {
+      memcpy(job->argb + (int64_t) row * tw,
+	     ls->rowbuf + (int64_t) row * ls->w + x_in_row,
+	     tw * 4);
+    }
+
+    push_tile(ls->pool, job);
+  }
+
+  ls->filled = 0;
+  ls->ty++;
+}
+
+static bool copy_band(uint32_t *band, int64_t y G_GNUC_UNUSED,
+		      int64_t h, void *arg) {
+  struct level_state *ls = arg;
+
+  // the band boundaries are the library's, not ours; carve the band
+  // into tile rows, which can straddle bands
+  int64_t off = 0;
+  while (off < h) {
+    int64_t row_h = MIN(ls->tile_size, ls->h - ls->ty * ls->tile_size);
+    int64_t take = MIN(row_h - ls->filled, h - off);
+    memcpy(ls->rowbuf + ls->filled * ls->w,
+	   band + off * ls->w,
+	   take * ls->w * 4);
+    ls->filled += take;
+    off += take;
+
+    if (ls->filled == row_h) {
+      flush_tile_row(ls);
+    }
+  }
+
+  return true;
+}
+
+static void write_level(openslide_t *osr, GThreadPool *pool,
+			const char *outdir, int32_t level,
+			int32_t tile_size) {
+  int64_t w, h;
+  openslide_get_level_dimensions(osr, level, &w, &h);
+
+  char *leveldir = g_strdup_printf("%s/%d", outdir, level);
+  if (g_mkdir_with_parents(leveldir, 0755)) {
+    fail("Can't create %s: %s", leveldir, strerror(errno));
+  }
+
+  struct level_state ls = {
+    .pool = pool,
+    .leveldir = leveldir,
+    .tile_size = tile_size,
+    .w = w,
+    .h = h,
+    .rowbuf = g_malloc((int64_t) w * tile_size * 4),
+  };
+
+  // stream the whole level in full-width bands: the library keeps every
+  // band on the same sub-pixel phase, so tiles on fractional-downsample
+  // levels join seamlessly
+  openslide_read_region_stream(osr, copy_band, &ls, 0, 0, level, w, h);
+  const char *err = openslide_get_error(osr);
+  if (err) {
+    fail("%s", err);
+  }
+  // the final band flushes the last (possibly partial) tile row
+
+  g_free(ls.rowbuf);
+  g_free(leveldir);
+}
+
+
+static const struct openslide_tools_usage_info usage_info = {
+  "slide tile-size output-dir [threads]",
+  "Export all levels of a virtual slide as a pyramid of PNG tiles.",
+  NULL,
+};
+
+int main (int argc, char **argv) {
+  _openslide_tools_parse_commandline(&usage_info, &argc, &argv);
+  if (argc != 4 && argc != 5) {
+    _openslide_tools_usage(&usage_info);
+  }
+
+  // get args
+  const char *slide = argv[1];
+  int32_t tile_size = strtol(argv[2], NULL, 10);
+  const char *outdir = argv[3];
+  int32_t threads = DEFAULT_THREADS;
+  if (argc == 5) {
+    threads = strtol(argv[4], NULL, 10);
+  }
+
+  // validate args
+  ENSURE_POS(tile_size);
+  ENSURE_POS(threads);
+  if (tile_size > 16384) {
+    fail("tile-size must be <= 16384");
+  }
+
+  // open slide
+  openslide_t *osr = openslide_open(slide);
+
+  // check errors
+  if (osr == NULL) {
+    fail("%s: Not a file that OpenSlide can recognize", slide);
+  }
+
+  const char *err = openslide_get_error(osr);
+  if (err) {
+    fail("%s: %s", slide, err);
+  }
+
+  if (g_mkdir_with_parents(outdir, 0755)) {
+    fail("Can't create %s: %s", outdir, strerror(errno));
+  }
+
+  // start the compression pool
+  limiter.mutex = g_mutex_new();
+  limiter.cond = g_cond_new();
+  limiter.max_pending = threads * 4;
+  GThreadPool *pool = g_thread_pool_new(compress_tile, NULL,
+					threads, FALSE, NULL);
+  if (pool == NULL) {
+    fail("Could not create thread pool");
+  }
+
+  for (int32_t level = 0; level < openslide_get_level_count(osr); level++) {
+    write_level(osr, pool, outdir, level, tile_size);
+  }
+
+  // drain
+  wait_for_pool();
+  g_thread_pool_free(pool, FALSE, TRUE);
+  g_cond_free(limiter.cond);
+  g_mutex_free(limiter.mutex);
+
+  openslide_close(osr);
+
+  return 0;
+}